@@ -9,64 +9,393 @@ struct vm_heap *kernel_heap;
 /* Extern reference to the kernel's page directory */
 extern struct vm_page_directory *kernel_directory;
 
+/* Helpers to reach the free-list links and the footer of a block */
+#define HOLE(h)    ((struct vm_heap_hole *)((uint32_t)(h) + sizeof(struct vm_heap_header)))
+#define FOOTER(h)  ((struct vm_heap_footer *)((uint32_t)(h) + (h)->hh_size - sizeof(struct vm_heap_footer)))
+
 /**
- * find_smallest_hole - Finds the smallest hole in the heap that can fit a given block of memory.
+ * size_class - Maps a block size to its first- and second-level size class.
  * 
- * @size: The size of the memory to be allocated.
- * @page_align: A flag indicating if the memory should be page-aligned.
- * @heap: The heap in which we are searching for space.
+ * @size: The block size, including header and footer.
+ * @fl:   Receives the first-level class.
+ * @sl:   Receives the second-level class.
+ */
+static void size_class(size_t size, uint32_t *fl, uint32_t *sl)
+{
+    if (size < (1 << VM_HEAP_FL_SHIFT)) {
+        *fl = 0;
+        *sl = size >> (VM_HEAP_FL_SHIFT - VM_HEAP_SL_SHIFT);
+    } else {
+        uint32_t bit = 31 - __builtin_clz(size);
+        *fl = bit - VM_HEAP_FL_SHIFT + 1;
+        *sl = (size >> (bit - VM_HEAP_SL_SHIFT)) & (VM_HEAP_SL_COUNT - 1);
+    }
+}
+
+/**
+ * addr_priority - Returns the treap priority of a hole.
+ * 
+ * Priorities are a multiplicative hash of the hole address, which keeps the
+ * address index balanced in expectation without a random number source.
  * 
- * Returns the index of the smallest hole that fits, or -1 if no suitable hole is found.
+ * @hole: The header of the hole.
  */
-static int32_t find_smallest_hole(size_t size, int page_align, struct vm_heap *heap)
+static uint32_t addr_priority(struct vm_heap_header *hole)
 {
-    uint32_t i = 0;
+    return ((uint32_t)hole >> 2) * 2654435761U;
+}
 
-    // Iterate through the sorted list of heap blocks
-    while (i < heap->h_index.sa_size) {
-        struct vm_heap_header *hdr = lookup_sorted_array(&heap->h_index, i);
-        
-        // Check if the memory should be page-aligned
-        if (page_align) {
-            uint32_t location = (uint32_t)hdr;
-            int32_t offset = 0;
+/**
+ * addr_rotate_up - Rotates a hole above its parent in the address index.
+ * 
+ * @x:    The hole to rotate up; it must have a parent.
+ * @heap: The heap the hole belongs to.
+ */
+static void addr_rotate_up(struct vm_heap_header *x, struct vm_heap *heap)
+{
+    struct vm_heap_header *p = HOLE(x)->ho_parent;
+    struct vm_heap_header *g = HOLE(p)->ho_parent;
+
+    if (HOLE(p)->ho_left == x) {
+        HOLE(p)->ho_left = HOLE(x)->ho_right;
+        if (HOLE(x)->ho_right != NULL)
+            HOLE(HOLE(x)->ho_right)->ho_parent = p;
+        HOLE(x)->ho_right = p;
+    } else {
+        HOLE(p)->ho_right = HOLE(x)->ho_left;
+        if (HOLE(x)->ho_left != NULL)
+            HOLE(HOLE(x)->ho_left)->ho_parent = p;
+        HOLE(x)->ho_left = p;
+    }
+    HOLE(p)->ho_parent = x;
+    HOLE(x)->ho_parent = g;
+
+    // Hook x where p used to hang
+    if (g == NULL)
+        heap->h_addr_root = x;
+    else if (HOLE(g)->ho_left == p)
+        HOLE(g)->ho_left = x;
+    else
+        HOLE(g)->ho_right = x;
+}
 
-            // Align the starting point to the next page boundary
-            if ((location + sizeof(struct vm_heap_header)) & 0xFFFFF000)
-                offset = 0x1000 - (location + sizeof(struct vm_heap_header)) % 0x1000;
+/**
+ * addr_insert - Adds a hole to the address-ordered index.
+ * 
+ * @hole: The header of the hole.
+ * @heap: The heap the hole belongs to.
+ */
+static void addr_insert(struct vm_heap_header *hole, struct vm_heap *heap)
+{
+    struct vm_heap_header **link = &heap->h_addr_root;
+    struct vm_heap_header *parent = NULL;
 
-            int32_t hole_size = (int32_t)hdr->hh_size - offset;
-            
-            // Check if the hole is large enough
-            if (hole_size >= (int32_t)size)
-                break;
-        }
-        else if (hdr->hh_size >= size) {
-            // If no page alignment is required, just check size
-            break;
-        }
+    // Descend to the leaf position for this address
+    while (*link != NULL) {
+        parent = *link;
+        link = (hole < parent) ? &HOLE(parent)->ho_left : &HOLE(parent)->ho_right;
+    }
+    HOLE(hole)->ho_left = NULL;
+    HOLE(hole)->ho_right = NULL;
+    HOLE(hole)->ho_parent = parent;
+    *link = hole;
+
+    // Restore the heap order on priorities
+    while (parent != NULL && addr_priority(parent) < addr_priority(hole)) {
+        addr_rotate_up(hole, heap);
+        parent = HOLE(hole)->ho_parent;
+    }
+
+    if (heap->h_addr_last == NULL || hole > heap->h_addr_last)
+        heap->h_addr_last = hole;
+}
 
-        i++;
+/**
+ * addr_prev - Returns the hole just below the given one in address order.
+ * 
+ * @hole: The header of the hole.
+ * 
+ * Returns the preceding hole, or NULL if this is the lowest one.
+ */
+static struct vm_heap_header *addr_prev(struct vm_heap_header *hole)
+{
+    struct vm_heap_header *h = HOLE(hole)->ho_left;
+
+    if (h != NULL) {
+        while (HOLE(h)->ho_right != NULL)
+            h = HOLE(h)->ho_right;
+        return h;
     }
 
-    // Return -1 if no suitable hole is found
-    if (i == heap->h_index.sa_size)
-        i = -1;
+    // Climb until we arrive from a right subtree
+    h = HOLE(hole)->ho_parent;
+    while (h != NULL && HOLE(h)->ho_left == hole) {
+        hole = h;
+        h = HOLE(h)->ho_parent;
+    }
+    return h;
+}
 
-    return i;
+/**
+ * addr_remove - Removes a hole from the address-ordered index.
+ * 
+ * @hole: The header of the hole.
+ * @heap: The heap the hole belongs to.
+ */
+static void addr_remove(struct vm_heap_header *hole, struct vm_heap *heap)
+{
+    struct vm_heap_header *child, *parent;
+
+    if (hole == heap->h_addr_last)
+        heap->h_addr_last = addr_prev(hole);
+
+    // Rotate the hole down until it has at most one child
+    while (HOLE(hole)->ho_left != NULL && HOLE(hole)->ho_right != NULL) {
+        struct vm_heap_header *l = HOLE(hole)->ho_left;
+        struct vm_heap_header *r = HOLE(hole)->ho_right;
+        addr_rotate_up(addr_priority(l) > addr_priority(r) ? l : r, heap);
+    }
+
+    // Splice it out
+    child = (HOLE(hole)->ho_left != NULL) ? HOLE(hole)->ho_left : HOLE(hole)->ho_right;
+    parent = HOLE(hole)->ho_parent;
+    if (child != NULL)
+        HOLE(child)->ho_parent = parent;
+    if (parent == NULL)
+        heap->h_addr_root = child;
+    else if (HOLE(parent)->ho_left == hole)
+        HOLE(parent)->ho_left = child;
+    else
+        HOLE(parent)->ho_right = child;
 }
 
-/** 
- * vm_heap_header_cmp - Compares two heap headers based on their size.
+/**
+ * set_tags - Writes the header and footer of a block.
+ * 
+ * @header:  The header of the block.
+ * @size:    The size of the block, including header and footer.
+ * @is_hole: 1 for a hole, 0 for an allocated block.
+ */
+static void set_tags(struct vm_heap_header *header, size_t size, int is_hole)
+{
+    header->hh_is_hole = is_hole;
+    header->hh_size = size;
+
+    struct vm_heap_footer *footer = FOOTER(header);
+    footer->hf_header = header;
+
+#if VM_HEAP_CHECK > 0
+    header->hh_magic = VM_HEAP_HDR_MAGIC;
+    footer->hf_magic = VM_HEAP_FTR_MAGIC;
+#endif
+#if VM_HEAP_CHECK > 1
+    header->hh_redzone = VM_HEAP_REDZONE;
+    footer->hf_redzone = VM_HEAP_REDZONE;
+#endif
+}
+
+/**
+ * check_block - Validates the boundary tags of an allocated block.
+ * 
+ * Does nothing in release builds.
+ * 
+ * @header: The header of the block.
+ * @heap:   The heap the block belongs to.
+ */
+static void check_block(struct vm_heap_header *header, struct vm_heap *heap)
+{
+#if VM_HEAP_CHECK > 0
+    kassert("header magic match", header->hh_magic == VM_HEAP_HDR_MAGIC);
+    kassert("footer magic match", FOOTER(header)->hf_magic == VM_HEAP_FTR_MAGIC);
+    kassert("block is allocated", header->hh_is_hole == 0);
+#endif
+#if VM_HEAP_CHECK > 1
+    kassert("block lies within the heap", (uint32_t)header >= heap->h_addr_start &&
+            (uint32_t)header + header->hh_size <= heap->h_addr_end);
+    kassert("footer points to its header", FOOTER(header)->hf_header == header);
+    kassert("leading red zone intact", header->hh_redzone == VM_HEAP_REDZONE);
+    kassert("trailing red zone intact", FOOTER(header)->hf_redzone == VM_HEAP_REDZONE);
+#endif
+}
+
+#if VM_HEAP_CHECK > 1
+/**
+ * check_hole - Validates a hole and its place in the index (paranoid builds only).
  * 
- * @a: Pointer to the first heap header.
- * @b: Pointer to the second heap header.
+ * @hole: The header of the hole.
+ * @heap: The heap the hole belongs to.
+ */
+static void check_hole(struct vm_heap_header *hole, struct vm_heap *heap)
+{
+    struct vm_heap_header *h;
+    uint32_t fl, sl;
+
+    kassert("hole magic match", hole->hh_magic == VM_HEAP_HDR_MAGIC &&
+            FOOTER(hole)->hf_magic == VM_HEAP_FTR_MAGIC);
+    kassert("block is a hole", hole->hh_is_hole == 1);
+    kassert("footer points to its header", FOOTER(hole)->hf_header == hole);
+
+    // The hole must be on the list of its size class
+    size_class(hole->hh_size, &fl, &sl);
+    for (h = hole; HOLE(h)->ho_prev != NULL; h = HOLE(h)->ho_prev)
+        ;
+    kassert("hole is on its size class list", heap->h_free[fl][sl] == h);
+    kassert("size class is marked non-empty",
+            (heap->h_fl_bitmap & (1 << fl)) && (heap->h_sl_bitmap[fl] & (1 << sl)));
+
+    // ...and hang off its parent in the address index
+    h = HOLE(hole)->ho_parent;
+    if (h == NULL)
+        kassert("hole is the index root", heap->h_addr_root == hole);
+    else
+        kassert("hole is a child of its parent", HOLE(h)->ho_left == hole || HOLE(h)->ho_right == hole);
+}
+#endif
+
+/**
+ * insert_hole - Pushes a hole onto the free list of its size class and into the address index.
  * 
- * Returns a comparison value for sorting (negative if a < b, positive if a > b).
+ * @hole: The header of the hole; its size must already be set.
+ * @heap: The heap the hole belongs to.
  */
-static int vm_heap_header_cmp(void *a, void *b)
+static void insert_hole(struct vm_heap_header *hole, struct vm_heap *heap)
 {
-    return (((struct vm_heap_header *)a)->hh_size - ((struct vm_heap_header *)b)->hh_size);
+    uint32_t fl, sl;
+    size_class(hole->hh_size, &fl, &sl);
+
+    struct vm_heap_header *head = heap->h_free[fl][sl];
+    HOLE(hole)->ho_next = head;
+    HOLE(hole)->ho_prev = NULL;
+    if (head != NULL)
+        HOLE(head)->ho_prev = hole;
+    heap->h_free[fl][sl] = hole;
+
+    // Mark the class as non-empty
+    heap->h_fl_bitmap |= (1 << fl);
+    heap->h_sl_bitmap[fl] |= (1 << sl);
+
+    addr_insert(hole, heap);
+
+    heap->h_holes++;
+    heap->h_free_bytes += hole->hh_size;
+
+#if VM_HEAP_CHECK > 1
+    check_hole(hole, heap);
+#endif
+}
+
+/**
+ * remove_hole - Unlinks a hole from the free list of its size class and from the address index.
+ * 
+ * @hole: The header of the hole; its size must still be the one it was inserted with.
+ * @heap: The heap the hole belongs to.
+ */
+static void remove_hole(struct vm_heap_header *hole, struct vm_heap *heap)
+{
+    uint32_t fl, sl;
+
+#if VM_HEAP_CHECK > 1
+    check_hole(hole, heap);
+#endif
+    size_class(hole->hh_size, &fl, &sl);
+
+    struct vm_heap_hole *links = HOLE(hole);
+    if (links->ho_next != NULL)
+        HOLE(links->ho_next)->ho_prev = links->ho_prev;
+    if (links->ho_prev != NULL)
+        HOLE(links->ho_prev)->ho_next = links->ho_next;
+    else
+        heap->h_free[fl][sl] = links->ho_next;
+
+    // Clear the class bits once its list runs empty
+    if (heap->h_free[fl][sl] == NULL) {
+        heap->h_sl_bitmap[fl] &= ~(1 << sl);
+        if (heap->h_sl_bitmap[fl] == 0)
+            heap->h_fl_bitmap &= ~(1 << fl);
+    }
+
+    addr_remove(hole, heap);
+
+    heap->h_holes--;
+    heap->h_free_bytes -= hole->hh_size;
+}
+
+/**
+ * class_round_up - Rounds a block size up to the next size class boundary.
+ * 
+ * Every hole of the class that starts at the returned size is at least
+ * `size` bytes. Large classes are wider than a page, so a heap grown by
+ * just `size` may still have no hole that find_hole() would return.
+ * 
+ * @size: The block size.
+ * 
+ * Returns the rounded size.
+ */
+static size_t class_round_up(size_t size)
+{
+    size_t step;
+
+    if (size < (1 << VM_HEAP_FL_SHIFT))
+        step = 1 << (VM_HEAP_FL_SHIFT - VM_HEAP_SL_SHIFT);
+    else
+        step = 1 << (31 - __builtin_clz(size) - VM_HEAP_SL_SHIFT);
+
+    return (size + step - 1) & ~(step - 1);
+}
+
+/**
+ * find_hole - Finds a hole that is guaranteed to fit a block of the given size.
+ * 
+ * The size is rounded up to the next class boundary, so that every hole in the
+ * first non-empty class at or above it is large enough. The bitmaps make the
+ * search O(1) regardless of how many holes the heap has.
+ * 
+ * @size: The minimum hole size needed.
+ * @heap: The heap in which we are searching for space.
+ * 
+ * Returns the header of a suitable hole, or NULL if no class can satisfy the request.
+ */
+static struct vm_heap_header *find_hole(size_t size, struct vm_heap *heap)
+{
+    uint32_t fl, sl, map;
+
+    // Round up so that the whole target class fits the request
+    size_class(class_round_up(size), &fl, &sl);
+    if (fl >= VM_HEAP_FL_COUNT)
+        return NULL;
+
+    // Look for a non-empty class within the same first-level class first
+    map = heap->h_sl_bitmap[fl] & (~0U << sl);
+    if (map == 0) {
+        // Fall back to the next non-empty first-level class
+        map = (fl + 1 < VM_HEAP_FL_COUNT) ? heap->h_fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (map == 0)
+            return NULL;
+        fl = __builtin_ctz(map);
+        map = heap->h_sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(map);
+
+    return heap->h_free[fl][sl];
+}
+
+/**
+ * make_hole - Writes the boundary tags of a hole and adds it to the free lists.
+ * 
+ * @addr: The address of the hole.
+ * @size: The size of the hole, including header and footer.
+ * @heap: The heap the hole belongs to.
+ * 
+ * Returns the header of the new hole.
+ */
+static struct vm_heap_header *make_hole(uint32_t addr, size_t size, struct vm_heap *heap)
+{
+    struct vm_heap_header *hole = (struct vm_heap_header *)addr;
+
+    set_tags(hole, size, 1);
+    insert_hole(hole, heap);
+
+    return hole;
 }
 
 /** 
@@ -109,17 +438,21 @@ struct vm_heap *init_heap(struct vm_heap *heap, uint32_t start, uint32_t end, ui
     kassert("start of the heap is page aligned", (start % 0x1000) == 0);
     kassert("end of the heap is page aligned", (end % 0x1000) == 0);
 
-    // Initialize the sorted array index for the heap
-    heap->h_index = place_sorted_array((void *)start, VM_HEAP_INDEX_SIZE, &vm_heap_header_cmp);
-
-    // Adjust the start address to accommodate the index
-    start += sizeof(void *) * VM_HEAP_INDEX_SIZE;
-
-    // Align the start address to the next page boundary
-    if (start & 0xFFFFF000) {
-        start &= 0xFFFFF000;
-        start += 0x1000;
-    }
+    // All size classes start out empty
+    bzero(heap->h_free, sizeof(heap->h_free));
+    bzero(heap->h_sl_bitmap, sizeof(heap->h_sl_bitmap));
+    heap->h_fl_bitmap = 0;
+    heap->h_addr_root = NULL;
+    heap->h_addr_last = NULL;
+
+    // Reset the statistics
+    heap->h_free_bytes = 0;
+    heap->h_holes = 0;
+    heap->h_allocs = 0;
+    heap->h_frees = 0;
+    heap->h_expands = 0;
+    heap->h_contracts = 0;
+    bzero(heap->h_hist, sizeof(heap->h_hist));
 
     // Set the heap's start, end, and max addresses
     heap->h_addr_start = start;
@@ -127,19 +460,27 @@ struct vm_heap *init_heap(struct vm_heap *heap, uint32_t start, uint32_t end, ui
     heap->h_addr_max = max;
     heap->h_su = su;
     heap->h_ro = ro;
+    heap->h_demand = 0;
 
     // Initialize the first large hole in the heap
-    struct vm_heap_header *hole = (void *)start;
-    hole->hh_size = end - start;
-    hole->hh_magic = VM_HEAP_HDR_MAGIC;
-    hole->hh_is_hole = 1;
-
-    // Insert the hole into the sorted array index
-    insert_sorted_array(&heap->h_index, hole);
+    make_hole(start, end - start, heap);
 
     return heap;
 }
 
+/**
+ * heap_flags - Returns the vm_map() flags of a heap's pages.
+ * 
+ * Heaps live in the kernel directory, which is part of every address space,
+ * so their pages are global.
+ * 
+ * @heap: The heap.
+ */
+static uint32_t heap_flags(struct vm_heap *heap)
+{
+    return VM_GLOBAL | (heap->h_ro ? 0 : VM_WRITE) | (heap->h_su ? 0 : VM_USER);
+}
+
 /** 
  * expand - Expands the heap to a larger size by allocating additional pages.
  * 
@@ -152,7 +493,7 @@ static void expand(size_t new_size, struct vm_heap *heap)
     kassert("expand to a greater size", new_size > (heap->h_addr_end - heap->h_addr_start));
 
     // Align the new size to the next page boundary
-    if (new_size & 0xFFFFF000) {
+    if (new_size & 0xFFF) {
         new_size &= 0xFFFFF000;
         new_size += 0x1000;
     }
@@ -160,16 +501,23 @@ static void expand(size_t new_size, struct vm_heap *heap)
     // Ensure we don't overflow the heap
     kassert("don't overflow the heap", heap->h_addr_start + new_size <= heap->h_addr_max);
 
-    // Get the current size and expand page-by-page
+    // Get the current size and expand
     uint32_t old_size = heap->h_addr_end - heap->h_addr_start;
-    uint32_t i = old_size;
-    while (i < new_size) {
-        alloc_frame(get_page(heap->h_addr_start + i, 1, kernel_directory), heap->h_su, heap->h_ro);
-        i += 0x1000;  // Increment by page size
+    uint32_t addr;
+
+    if (heap->h_demand) {
+        // A demand-paged heap only needs the page tables now, one per 4MB; heap_fault() does the rest
+        for (addr = heap->h_addr_start + old_size; addr < heap->h_addr_start + new_size;
+             addr = (addr & 0xFFC00000) + 0x400000)
+            get_page(addr, 1, kernel_directory);
+    } else {
+        vm_map_range(kernel_directory, heap->h_addr_start + old_size, (new_size - old_size) / 0x1000,
+                     heap_flags(heap));
     }
 
     // Update the heap's end address
     heap->h_addr_end = heap->h_addr_start + new_size;
+    heap->h_expands++;
 }
 
 /**
@@ -186,8 +534,8 @@ static uint32_t contract(uint32_t new_size, struct vm_heap *heap)
     kassert("expand contract a smaller size", new_size < (heap->h_addr_end - heap->h_addr_start));
 
     // Align the new size to the next page boundary
-    if (new_size & 0x1000) {
-        new_size &= 0x1000;
+    if (new_size & 0xFFF) {
+        new_size &= 0xFFFFF000;
         new_size += 0x1000;
     }
 
@@ -195,26 +543,71 @@ static uint32_t contract(uint32_t new_size, struct vm_heap *heap)
     if (new_size < VM_HEAP_MIN_SIZE)
         new_size = VM_HEAP_MIN_SIZE;
 
-    // Get the current size and free pages until the heap is the new size
+    // Nothing to give back if the heap is already at its minimum
     uint32_t old_size = heap->h_addr_end - heap->h_addr_start;
-    uint32_t i = old_size - 0x1000;
-    while (new_size < i) {
-        free_frame(get_page(heap->h_addr_start + i, 0, kernel_directory));
-        i -= 0x1000;  // Decrement by page size
-    }
+    if (new_size >= old_size)
+        return old_size;
+
+    // Free the pages past the new end, flushing them from the TLB in one go
+    vm_unmap_range(kernel_directory, heap->h_addr_start + new_size, (old_size - new_size) / 0x1000);
 
     // Update the heap's end address
     heap->h_addr_end = heap->h_addr_start + new_size;
+    heap->h_contracts++;
 
     return new_size;
 }
 
+/**
+ * grow - Expands the heap so that a hole of at least `size` bytes exists.
+ * 
+ * The new pages are merged into the endmost hole when it touches the old end
+ * of the heap, and become a hole of their own otherwise.
+ * 
+ * @size: The size of the hole that is needed.
+ * @heap: The heap to grow.
+ */
+static void grow(size_t size, struct vm_heap *heap)
+{
+    // Save current heap details
+    uint32_t old_length = heap->h_addr_end - heap->h_addr_start;
+    uint32_t old_end_address = heap->h_addr_end;
+
+    // Expand the heap and update the new size
+    expand(old_length + size, heap);
+    uint32_t new_length = heap->h_addr_end - heap->h_addr_start;
+
+    // The address index tracks the endmost hole
+    struct vm_heap_header *last = heap->h_addr_last;
+
+    if (last != NULL && (uint32_t)last + last->hh_size == old_end_address) {
+        // The endmost hole touches the old end: grow it over the new pages
+        remove_hole(last, heap);
+        make_hole((uint32_t)last, last->hh_size + new_length - old_length, heap);
+    } else {
+        // Otherwise the new pages become a hole of their own
+        make_hole(old_end_address, new_length - old_length, heap);
+    }
+}
+
+/**
+ * account - Records allocations in the heap statistics.
+ * 
+ * @size:  The (rounded) size of each allocation.
+ * @count: The number of allocations.
+ * @heap:  The heap the allocations were made from.
+ */
+static void account(uint32_t size, uint32_t count, struct vm_heap *heap)
+{
+    uint32_t bucket = (size < 16) ? 0 : (31 - __builtin_clz(size)) - 3;
+
+    heap->h_hist[(bucket < VM_HEAP_HIST_BUCKETS) ? bucket : VM_HEAP_HIST_BUCKETS - 1] += count;
+    heap->h_allocs += count;
+}
+
 /**
  * alloc - Allocates memory from the heap.
  * 
- * This function searches for a suitable free block in the heap and returns a pointer
- * to a newly allocated memory block. If no suitable block is found, the heap is expanded.
- *
  * @size:        The requested size for the allocation.
  * @page_align:  If non-zero, ensures the allocation is page-aligned.
  * @heap:        The heap from which memory is allocated.
@@ -223,130 +616,157 @@ static uint32_t contract(uint32_t new_size, struct vm_heap *heap)
  */
 void *alloc(uint32_t size, int page_align, struct vm_heap *heap)
 {
+    return alloc_aligned(size, page_align ? 0x1000 : 0, heap);
+}
+
+/**
+ * alloc_aligned - Allocates memory from the heap at a given alignment.
+ * 
+ * This function picks a hole from the segregated free lists and returns a pointer
+ * to a newly allocated memory block. If no suitable block is found, the heap is expanded.
+ * 
+ * The hole is searched for with enough room to slide the block up to the next
+ * aligned address. A hole that is already aligned is used as is; otherwise the
+ * leading slack becomes a hole, or, when it is too small for that, is handed to
+ * the block in front of it. Nothing is left unusable.
+ * 
+ * @size:        The requested size for the allocation.
+ * @align:       The required alignment (power of two, 0 for word alignment).
+ * @heap:        The heap from which memory is allocated.
+ * 
+ * Returns: A pointer to the allocated memory block.
+ */
+void *alloc_aligned(uint32_t size, uint32_t align, struct vm_heap *heap)
+{
+    // Blocks are always word-aligned
+    if (align < 4)
+        align = 4;
+    kassert("alignment is a power of two", (align & (align - 1)) == 0);
+
+    // Keep blocks word-aligned and large enough to hold the free-list links once freed
+    size = (size + 3) & ~3;
+    if (size < sizeof(struct vm_heap_hole))
+        size = sizeof(struct vm_heap_hole);
+
     // Account for the size of header and footer
     size_t new_size = size + sizeof(struct vm_heap_header) + sizeof(struct vm_heap_footer);
 
-    // Search for the smallest hole that fits the requested size
-    int i = find_smallest_hole(new_size, page_align, heap);
+    // An aligned block may have to slide up by almost `align`, leaving a minimal hole in front
+    size_t search_size = new_size;
+    if (align > 4)
+        search_size += align - 4 + VM_HEAP_MIN_BLOCK;
 
-    if (i == -1) { // No suitable hole found
-        // Save current heap details
-        uint32_t old_length = heap->h_addr_end - heap->h_addr_start;
-        uint32_t old_end_address = heap->h_addr_end;
-
-        // Expand the heap and update the new size
-        expand(old_length + new_size, heap);
-        uint32_t new_length = heap->h_addr_end - heap->h_addr_start;
-
-        // Find the last header in the heap
-        i = 0;
-        uint32_t idx = -1; 
-        uint32_t value = 0x0;
-
-        // Search for the endmost header
-        while (i < heap->h_index.sa_size) {
-            uint32_t tmp = (uint32_t)lookup_sorted_array(&heap->h_index, i);
-            if (tmp > value) {
-                value = tmp;
-                idx = i;
-            }
-            i++;
-        }
+    struct vm_heap_header *hole = find_hole(search_size, heap);
 
-        // Add a new header if no headers found
-        if (idx == -1) {
-            struct vm_heap_header *header = (struct vm_heap_header *)old_end_address;
-            header->hh_magic = VM_HEAP_HDR_MAGIC;
-            header->hh_size = new_length - old_length;
-            header->hh_is_hole = 1;
-
-            struct vm_heap_footer *footer = (struct vm_heap_footer *)(old_end_address + header->hh_size - sizeof(struct vm_heap_footer));
-            footer->hf_magic = VM_HEAP_FTR_MAGIC;
-            footer->hf_header = header;
-
-            insert_sorted_array(&heap->h_index, (void*)header);
-        } else {
-            // Adjust the last header and footer
-            struct vm_heap_header *header = lookup_sorted_array(&heap->h_index, idx);
-            header->hh_size += new_length - old_length;
-
-            struct vm_heap_footer *footer = (struct vm_heap_footer *)((uint32_t)header + header->hh_size - sizeof(struct vm_heap_footer));
-            footer->hf_magic = VM_HEAP_FTR_MAGIC;
-            footer->hf_header = header;
-        }
+    if (hole == NULL) { // No suitable hole found
+        // Grow by the rounded size, or the new hole may still be too small for find_hole()
+        grow(class_round_up(search_size), heap);
 
         // Retry the allocation with the updated heap
-        return (alloc(size, page_align, heap));
+        return (alloc_aligned(size, align, heap));
     }
 
     // We found a suitable hole, let's process it
-    struct vm_heap_header *orig_hole_header = lookup_sorted_array(&heap->h_index, i);
-    uint32_t orig_hole_pos = (uint32_t)orig_hole_header;
-    uint32_t orig_hole_size = orig_hole_header->hh_size;
+    remove_hole(hole, heap);
+    uint32_t orig_hole_pos = (uint32_t)hole;
+    uint32_t orig_hole_size = hole->hh_size;
+
+    // Slide the block up to the requested alignment
+    uint32_t data = orig_hole_pos + sizeof(struct vm_heap_header);
+    uint32_t offset = ((data + align - 1) & ~(align - 1)) - data;
+
+    if (offset != 0 && offset < VM_HEAP_MIN_BLOCK && orig_hole_pos > heap->h_addr_start) {
+        // Too small for a hole: the block in front (never a hole, holes are coalesced) takes it
+        struct vm_heap_header *prev = ((struct vm_heap_footer *)orig_hole_pos - 1)->hf_header;
+        set_tags(prev, prev->hh_size + offset, 0);
+    } else if (offset != 0) {
+        // The leading space must be able to stand as a hole of its own
+        while (offset < VM_HEAP_MIN_BLOCK)
+            offset += align;
+        make_hole(orig_hole_pos, offset, heap);
+    }
+    orig_hole_pos += offset;
+    orig_hole_size -= offset;
 
-    // Check if we should split the hole into two parts
-    if ((orig_hole_size - new_size) < (sizeof(struct vm_heap_header) + sizeof(struct vm_heap_footer))) {
-        size += orig_hole_size - new_size;
+    // Don't split off a remainder too small to be a hole; hand it to the block instead
+    if (orig_hole_size - new_size < VM_HEAP_MIN_BLOCK)
         new_size = orig_hole_size;
-    }
 
-    // Handle page alignment if requested
-    if (page_align && (orig_hole_pos & 0xFFFFF000)) {
-        uint32_t new_location = orig_hole_pos + 0x1000 - (orig_hole_pos & 0xFFF) - sizeof(struct vm_heap_header);
-        struct vm_heap_header *hole_header = (struct vm_heap_header *)orig_hole_pos;
-        hole_header->hh_size = 0x1000 - (orig_hole_pos & 0xFFF) - sizeof(struct vm_heap_header);
-        hole_header->hh_magic = VM_HEAP_HDR_MAGIC;
-        hole_header->hh_is_hole = 1;
+    // Overwrite the original header with the new block header and footer
+    struct vm_heap_header *block_header = (struct vm_heap_header *)orig_hole_pos;
+    set_tags(block_header, new_size, 0);
 
-        struct vm_heap_footer *hole_footer = (struct vm_heap_footer *)((uint32_t)new_location - sizeof(struct vm_heap_footer));
-        hole_footer->hf_magic = VM_HEAP_FTR_MAGIC;
-        hole_footer->hf_header = hole_header;
+    // If there is remaining space, create a new hole
+    if (orig_hole_size > new_size)
+        make_hole(orig_hole_pos + new_size, orig_hole_size - new_size, heap);
 
-        orig_hole_pos = new_location;
-        orig_hole_size -= hole_header->hh_size;
-    } else {
-        // Remove the hole from the index if not page-aligned
-        remove_sorted_array(&heap->h_index, i);
-    }
+    account(size, 1, heap);
 
-    // Overwrite the original header with the new block header
-    struct vm_heap_header *block_header = (struct vm_heap_header *)orig_hole_pos;
-    block_header->hh_magic = VM_HEAP_HDR_MAGIC;
-    block_header->hh_is_hole = 0;
-    block_header->hh_size = new_size;
+    // Return the pointer to the allocated block, skipping the header
+    return (void *)((uint32_t)block_header + sizeof(struct vm_heap_header));
+}
 
-    // Set the footer for the allocated block
-    struct vm_heap_footer *block_footer = (struct vm_heap_footer *)(orig_hole_pos + sizeof(struct vm_heap_header) + size);
-    block_footer->hf_magic = VM_HEAP_FTR_MAGIC;
-    block_footer->hf_header = block_header;
+/**
+ * release - Turns an allocated block into a hole, coalescing it with its neighbours.
+ * 
+ * If the resulting hole reaches the end of the heap, whole pages are given back.
+ * 
+ * @header: The header of the block.
+ * @heap:   The heap the block belongs to.
+ */
+static void release(struct vm_heap_header *header, struct vm_heap *heap)
+{
+    struct vm_heap_footer *footer = FOOTER(header);
 
-    // If there is remaining space, create a new hole
-    if (orig_hole_size - new_size > 0) {
-        struct vm_heap_header *hole_header = (struct vm_heap_header *)(orig_hole_pos + sizeof(struct vm_heap_header) + size + sizeof(struct vm_heap_footer));
-        hole_header->hh_magic = VM_HEAP_HDR_MAGIC;
-        hole_header->hh_is_hole = 1;
-        hole_header->hh_size = orig_hole_size - new_size;
-
-        struct vm_heap_footer *hole_footer = (struct vm_heap_footer *)((uint32_t)hole_header + orig_hole_size - new_size - sizeof(struct vm_heap_footer));
-        if ((uint32_t)hole_footer < heap->h_addr_end) {
-            hole_footer->hf_magic = VM_HEAP_FTR_MAGIC;
-            hole_footer->hf_header = hole_header;
+#if VM_HEAP_CHECK > 1
+    // Poison the payload, so that stale pointers read garbage
+    memset((void *)((uint32_t)header + sizeof(struct vm_heap_header)), VM_HEAP_POISON,
+           header->hh_size - sizeof(struct vm_heap_header) - sizeof(struct vm_heap_footer));
+#endif
+
+    // Mark the block as a hole
+    header->hh_is_hole = 1;
+
+    // Attempt to unify with the block on the left; blocks tile the heap, so
+    // any block past the start has a footer right in front of it
+    if ((uint32_t)header > heap->h_addr_start) {
+        struct vm_heap_footer *test_footer = (struct vm_heap_footer *)((uint32_t)header - sizeof(struct vm_heap_footer));
+        if (test_footer->hf_header->hh_is_hole == 1) {
+            struct vm_heap_header *left = test_footer->hf_header;
+            remove_hole(left, heap);
+            left->hh_size += header->hh_size;
+            header = left;
         }
+    }
 
-        // Add the new hole to the index
-        insert_sorted_array(&heap->h_index, (void*)hole_header);
+    // Attempt to unify with the block on the right
+    struct vm_heap_header *test_header = (struct vm_heap_header *)((uint32_t)footer + sizeof(struct vm_heap_footer));
+    if ((uint32_t)test_header < heap->h_addr_end && test_header->hh_is_hole) {
+        remove_hole(test_header, heap);
+        header->hh_size += test_header->hh_size;
     }
 
-    // Return the pointer to the allocated block, skipping the header
-    return (void *)((uint32_t)block_header + sizeof(struct vm_heap_header));
+    // If the hole reaches the end of the heap, give whole pages back
+    if ((uint32_t)header + header->hh_size == heap->h_addr_end) {
+        uint32_t old_length = heap->h_addr_end - heap->h_addr_start;
+        uint32_t keep = (uint32_t)header - heap->h_addr_start + VM_HEAP_MIN_BLOCK;
+
+        if (keep + 0x1000 <= old_length) {
+            uint32_t new_length = contract(keep, heap);
+            header->hh_size -= old_length - new_length;
+        }
+    }
+
+    // Rewrite the boundary tags and add the hole back to its size class
+    make_hole((uint32_t)header, header->hh_size, heap);
 }
 
 /**
  * free - Frees a previously allocated block of memory.
- *
+ * 
  * This function marks the memory block as free and tries to coalesce adjacent free blocks
  * to reduce fragmentation.
- *
+ * 
  * @p:    The pointer to the memory block to be freed.
  * @heap: The heap from which memory was allocated.
  */
@@ -356,65 +776,259 @@ void free(void *p, struct vm_heap *heap)
     if (p == NULL || heap == NULL)
         return;
 
-    // Get the header and footer for the block being freed
+    // Get the header for the block being freed
     struct vm_heap_header *header = (struct vm_heap_header *)((uint32_t)p - sizeof(struct vm_heap_header));
-    struct vm_heap_footer *footer = (struct vm_heap_footer *)((uint32_t)header + header->hh_size - sizeof(struct vm_heap_footer));
 
-    // Sanity checks for header and footer magic values
-    kassert("header magic match", header->hh_magic == VM_HEAP_HDR_MAGIC);
-    kassert("footer magic match", footer->hf_magic == VM_HEAP_FTR_MAGIC);
+    // Sanity checks for the boundary tags
+    check_block(header, heap);
 
-    // Mark the block as a hole
-    header->hh_is_hole = 1;
-    char do_add = 1;
-
-    // Attempt to unify with the block on the left
-    struct vm_heap_footer *test_footer = (struct vm_heap_footer *)((uint32_t)header - sizeof(struct vm_heap_footer));
-    if (test_footer->hf_magic == VM_HEAP_FTR_MAGIC && test_footer->hf_header->hh_is_hole == 1) {
-        uint32_t cache_size = header->hh_size;
-        header = test_footer->hf_header;
-        footer->hf_header = header;
-        header->hh_size += cache_size;
-        do_add = 0; // No need to add it again since it's already in the index
+    heap->h_frees++;
+    release(header, heap);
+}
+
+/**
+ * alloc_bulk - Allocates several blocks of the same size at once.
+ * 
+ * All blocks are carved, back to back, out of a single hole, so the size
+ * classes and the address index are updated once for the whole batch.
+ * 
+ * @size:  The requested size of each block.
+ * @count: The number of blocks.
+ * @ptrs:  Receives the `count` block pointers, in address order.
+ * @heap:  The heap from which memory is allocated.
+ */
+void alloc_bulk(uint32_t size, uint32_t count, void **ptrs, struct vm_heap *heap)
+{
+    uint32_t i;
+
+    if (count == 0)
+        return;
+
+    // Keep blocks word-aligned and large enough to hold the free-list links once freed
+    size = (size + 3) & ~3;
+    if (size < sizeof(struct vm_heap_hole))
+        size = sizeof(struct vm_heap_hole);
+
+    size_t block_size = size + sizeof(struct vm_heap_header) + sizeof(struct vm_heap_footer);
+    size_t total = block_size * count;
+
+    struct vm_heap_header *hole;
+    while ((hole = find_hole(total, heap)) == NULL)
+        grow(class_round_up(total), heap);
+
+    remove_hole(hole, heap);
+    uint32_t pos = (uint32_t)hole;
+    uint32_t rest = hole->hh_size - total;
+
+    for (i = 0; i < count; i++) {
+        struct vm_heap_header *block_header = (struct vm_heap_header *)pos;
+
+        // The last block takes a remainder too small to be a hole
+        set_tags(block_header, (i == count - 1 && rest < VM_HEAP_MIN_BLOCK) ? block_size + rest : block_size, 0);
+
+        ptrs[i] = (void *)(pos + sizeof(struct vm_heap_header));
+        pos += block_header->hh_size;
     }
 
-    // Attempt to unify with the block on the right
-    struct vm_heap_header *test_header = (struct vm_heap_header *)((uint32_t)footer + sizeof(struct vm_heap_footer));
-    if (test_header->hh_magic == VM_HEAP_HDR_MAGIC && test_header->hh_is_hole) {
-        header->hh_size += test_header->hh_size;
-        test_footer = (struct vm_heap_footer *)((uint32_t)test_header + test_header->hh_size - sizeof(struct vm_heap_footer));
-        footer = test_footer;
-
-        // Find and remove the right block from the index
-        uint32_t i = 0;
-        while (i < heap->h_index.sa_size && lookup_sorted_array(&heap->h_index, i) != test_header)
-            i++;
-        kassert("found an item while unifying right", i < heap->h_index.sa_size);
-        remove_sorted_array(&heap->h_index, i);
+    // Whatever is left of the hole goes back as one hole
+    if (rest >= VM_HEAP_MIN_BLOCK)
+        make_hole(pos, rest, heap);
+
+    account(size, count, heap);
+}
+
+/**
+ * free_bulk - Frees several blocks at once.
+ * 
+ * The pointers are sorted by address, so that runs of neighbouring blocks
+ * (such as a batch from alloc_bulk) are merged first and go back to the heap
+ * as a single hole, with one coalescing pass each.
+ * 
+ * @ptrs:  The blocks to free; the array is reordered. NULL entries are skipped.
+ * @count: The number of entries in `ptrs`.
+ * @heap:  The heap from which the memory was allocated.
+ */
+void free_bulk(void **ptrs, uint32_t count, struct vm_heap *heap)
+{
+    uint32_t gap, i, j;
+
+    if (heap == NULL)
+        return;
+
+    // Shell sort by address
+    for (gap = count / 2; gap > 0; gap /= 2) {
+        for (i = gap; i < count; i++) {
+            void *p = ptrs[i];
+            for (j = i; j >= gap && (uint32_t)ptrs[j - gap] > (uint32_t)p; j -= gap)
+                ptrs[j] = ptrs[j - gap];
+            ptrs[j] = p;
+        }
     }
 
-    // If the footer is at the end of the heap, attempt to contract the heap
-    if ((uint32_t)footer + sizeof(struct vm_heap_footer) == heap->h_addr_end) {
-        uint32_t old_length = heap->h_addr_end - heap->h_addr_start;
-        uint32_t new_length = contract((uint32_t)header - heap->h_addr_start, heap);
+    struct vm_heap_header *run = NULL;
 
-        // If the block will still exist, adjust its size
-        if (header->hh_size - (old_length - new_length) > 0) {
-            header->hh_size -= old_length - new_length;
-            footer = (struct vm_heap_footer *)((uint32_t)header + header->hh_size - sizeof(struct vm_heap_footer));
-            footer->hf_magic = VM_HEAP_FTR_MAGIC;
-            footer->hf_header = header;
-        } else {
-            // Otherwise, remove the block from the index if it no longer exists
-            uint32_t i = 0;
-            while (i < heap->h_index.sa_size && lookup_sorted_array(&heap->h_index, i) != test_header)
-                i++;
-            if (i < heap->h_index.sa_size)
-                remove_sorted_array(&heap->h_index, i);
+    for (i = 0; i < count; i++) {
+        if (ptrs[i] == NULL)
+            continue;
+
+        struct vm_heap_header *header = (struct vm_heap_header *)((uint32_t)ptrs[i] - sizeof(struct vm_heap_header));
+
+        // Sanity checks for the boundary tags
+        check_block(header, heap);
+
+        heap->h_frees++;
+
+        // Extend the current run if the block follows it directly
+        if (run != NULL && (uint32_t)run + run->hh_size == (uint32_t)header) {
+            run->hh_size += header->hh_size;
+            continue;
+        }
+
+        if (run != NULL)
+            release(run, heap);
+        run = header;
+    }
+
+    if (run != NULL)
+        release(run, heap);
+}
+
+/**
+ * alloc_size - Returns the usable size of an allocated block.
+ * 
+ * @p:    The pointer to the allocated memory block.
+ * @heap: The heap from which memory was allocated.
+ * 
+ * Returns the number of bytes between the header and the footer of the block.
+ */
+size_t alloc_size(void *p, struct vm_heap *heap)
+{
+    struct vm_heap_header *header = (struct vm_heap_header *)((uint32_t)p - sizeof(struct vm_heap_header));
+
+    check_block(header, heap);
+
+    return header->hh_size - sizeof(struct vm_heap_header) - sizeof(struct vm_heap_footer);
+}
+
+/**
+ * heap_fault - Backs a page of a demand-paged heap with a zeroed frame.
+ * 
+ * The page table already exists, since expand() creates it, so nothing here
+ * allocates from the heap.
+ * 
+ * @address: The faulting virtual address.
+ * @heap:    The heap to check (may be NULL).
+ * 
+ * Returns 1 if the page was backed, 0 if the address is not the heap's to back.
+ */
+int heap_fault(uint32_t address, struct vm_heap *heap)
+{
+    struct vm_page *page;
+    uint32_t frame;
+
+    if (heap == NULL || !heap->h_demand)
+        return 0;
+    if (address < heap->h_addr_start || address >= heap->h_addr_end)
+        return 0;
+
+    page = get_page(address, 0, kernel_directory);
+    if (page == NULL || page->p_present)
+        return 0;
+
+    // Usually a frame the zeroing thread prepared ahead of time
+    frame = alloc_frame_zeroed();
+
+    vm_map(kernel_directory, address & 0xFFFFF000, frame, 1, heap_flags(heap));
+
+    return 1;
+}
+
+/**
+ * heap_populate - Backs every page of a range of a demand-paged heap.
+ * 
+ * @address: The start of the range.
+ * @len:     The length of the range, in bytes.
+ * @heap:    The heap the range belongs to.
+ */
+void heap_populate(uint32_t address, size_t len, struct vm_heap *heap)
+{
+    uint32_t page;
+
+    if (len == 0)
+        return;
+
+    for (page = address & 0xFFFFF000; page < address + len; page += 0x1000)
+        heap_fault(page, heap);
+}
+
+/**
+ * heap_stats - Takes a snapshot of the usage and fragmentation of a heap.
+ * 
+ * All counters are kept up to date as the heap changes; only the largest hole
+ * is looked up here, in the highest non-empty size class.
+ * 
+ * @heap:  The heap to inspect.
+ * @stats: Receives the snapshot.
+ */
+void heap_stats(struct vm_heap *heap, struct vm_heap_stats *stats)
+{
+    uint32_t largest = 0;
+    uint32_t i;
+
+    // The largest hole lives in the highest non-empty class
+    if (heap->h_fl_bitmap != 0) {
+        uint32_t fl = 31 - __builtin_clz(heap->h_fl_bitmap);
+        uint32_t sl = 31 - __builtin_clz(heap->h_sl_bitmap[fl]);
+        struct vm_heap_header *h;
+
+        for (h = heap->h_free[fl][sl]; h != NULL; h = HOLE(h)->ho_next) {
+            if (h->hh_size > largest)
+                largest = h->hh_size;
         }
     }
 
-    // If necessary, add the block back to the free holes index
-    if (do_add)
-        insert_sorted_array(&heap->h_index, header);
+    stats->hs_size = heap->h_addr_end - heap->h_addr_start;
+    stats->hs_free = heap->h_free_bytes;
+    stats->hs_used = stats->hs_size - stats->hs_free;
+    stats->hs_holes = heap->h_holes;
+    stats->hs_largest_hole = largest;
+    // Scale by hundredths of the free space so the percentage cannot overflow
+    stats->hs_frag = (stats->hs_free < 100) ? 0 :
+                     (stats->hs_free - largest) / (stats->hs_free / 100);
+    if (stats->hs_frag > 100)
+        stats->hs_frag = 100;
+    stats->hs_allocs = heap->h_allocs;
+    stats->hs_frees = heap->h_frees;
+    stats->hs_expands = heap->h_expands;
+    stats->hs_contracts = heap->h_contracts;
+    for (i = 0; i < VM_HEAP_HIST_BUCKETS; i++)
+        stats->hs_hist[i] = heap->h_hist[i];
+}
+
+/**
+ * heap_dump - Prints the statistics of a heap to the screen.
+ * 
+ * @heap: The heap to report on.
+ */
+void heap_dump(struct vm_heap *heap)
+{
+    struct vm_heap_stats stats;
+    uint32_t i;
+
+    heap_stats(heap, &stats);
+
+    printk("heap %x-%x: %u bytes, %u used, %u free\n", heap->h_addr_start,
+           heap->h_addr_end, stats.hs_size, stats.hs_used, stats.hs_free);
+    printk("  holes %u, largest %u, fragmentation %u%%\n",
+           stats.hs_holes, stats.hs_largest_hole, stats.hs_frag);
+    printk("  allocs %u, frees %u, expands %u, contracts %u\n",
+           stats.hs_allocs, stats.hs_frees, stats.hs_expands, stats.hs_contracts);
+    printk("  sizes:");
+    for (i = 0; i < VM_HEAP_HIST_BUCKETS; i++) {
+        if (i < VM_HEAP_HIST_BUCKETS - 1)
+            printk(" <%u:%u", 16 << i, stats.hs_hist[i]);
+        else
+            printk(" >=%u:%u", 16 << (i - 1), stats.hs_hist[i]);
+    }
+    printk("\n");
 }
\ No newline at end of file
@@ -2,42 +2,120 @@
 #define INCLUDE_HEAP_H
 
 #include "system.h"
-#include "sorted_array.h"
 
 // Memory constants for heap management
 #define VM_KERN_HEAP_START           0xC0000000   // Start address for the kernel heap
 #define VM_KERN_HEAP_INITIAL_SIZE    0x100000     // Initial size of the kernel heap
-#define VM_HEAP_INDEX_SIZE           0x20000      // Size of the heap index
 #define VM_HEAP_HDR_MAGIC            0x123890AB   // Magic number used for block header identification
 #define VM_HEAP_FTR_MAGIC            0xBA098321   // Magic number used for block footer identification
 #define VM_HEAP_MIN_SIZE             0x70000      // Minimum size of the heap
 
+/*
+ * Segregated-fit size classes:
+ * Every hole lives on the free list of its size class. Sizes below
+ * (1 << VM_HEAP_FL_SHIFT) share first-level class 0; above that, each power
+ * of two is one first-level class, split linearly into VM_HEAP_SL_COUNT
+ * second-level classes.
+ */
+#define VM_HEAP_SL_SHIFT             2            // log2 of the second-level classes per first-level class
+#define VM_HEAP_SL_COUNT             (1 << VM_HEAP_SL_SHIFT)
+#define VM_HEAP_FL_SHIFT             7            // First power of two with its own first-level class
+#define VM_HEAP_FL_COUNT             (32 - VM_HEAP_FL_SHIFT + 1)
+
+// Allocation size histogram: bucket b counts sizes below (16 << b); the last bucket takes the rest
+#define VM_HEAP_HIST_BUCKETS         12
+
 /*
  * Heap Block Structure Definitions:
  * These structures are used to manage the heap's allocated and free memory regions.
  */
 
+/*
+ * Validation level, chosen at build time (make release / make paranoid):
+ *   0 - release: compact boundary tags, no checks
+ *   1 - magic numbers in every boundary tag, checked on free (default)
+ *   2 - paranoid: also red zones around every block, index validation on
+ *       every update, and freed memory is poisoned
+ */
+#ifndef VM_HEAP_CHECK
+#define VM_HEAP_CHECK                1
+#endif
+
+#define VM_HEAP_REDZONE              0xFDFDFDFD   // Fill of the red zones around a block (VM_HEAP_CHECK > 1)
+#define VM_HEAP_POISON               0x6B         // Fill of freed memory (VM_HEAP_CHECK > 1)
+
 // Header structure for each block in the heap
 struct vm_heap_header {
-    uint32_t hh_magic;  // Magic number (VM_HEAP_HDR_MAGIC) for error checking and identification
-    int hh_is_hole;     // Flag: 1 if this is a hole (free block), 0 if this is an allocated block
-    size_t hh_size;     // Size of the block, including the footer
+#if VM_HEAP_CHECK > 0
+    uint32_t hh_magic;           // Magic number (VM_HEAP_HDR_MAGIC) for error checking and identification
+#endif
+    uint32_t hh_is_hole : 1;     // Flag: 1 if this is a hole (free block), 0 if this is an allocated block
+    uint32_t hh_size : 31;       // Size of the block, including the footer
+#if VM_HEAP_CHECK > 1
+    uint32_t hh_redzone;         // Red zone in front of the payload (VM_HEAP_REDZONE)
+#endif
 };
 
 // Footer structure for each block in the heap
 struct vm_heap_footer {
+#if VM_HEAP_CHECK > 1
+    uint32_t hf_redzone;         // Red zone behind the payload (VM_HEAP_REDZONE)
+#endif
+#if VM_HEAP_CHECK > 0
     uint32_t hf_magic;           // Magic number (VM_HEAP_FTR_MAGIC) for error checking
+#endif
     struct vm_heap_header *hf_header; // Pointer to the corresponding block header
 };
 
+// Index links, stored in the payload of a hole right after its header
+struct vm_heap_hole {
+    struct vm_heap_header *ho_next;   // Next hole in the same size class
+    struct vm_heap_header *ho_prev;   // Previous hole in the same size class
+    struct vm_heap_header *ho_left;   // Lower-addressed subtree of the address index
+    struct vm_heap_header *ho_right;  // Higher-addressed subtree of the address index
+    struct vm_heap_header *ho_parent; // Parent in the address index
+};
+
+// Smallest block the heap hands out or keeps as a hole
+#define VM_HEAP_MIN_BLOCK   (sizeof(struct vm_heap_header) + sizeof(struct vm_heap_hole) + sizeof(struct vm_heap_footer))
+
 // Main heap structure to manage the heap's state
 struct vm_heap {
-    struct sorted_array h_index;     // Index of free memory blocks (sorted array for quick allocation)
+    struct vm_heap_header *h_free[VM_HEAP_FL_COUNT][VM_HEAP_SL_COUNT]; // Free list heads, one per size class
+    uint32_t h_fl_bitmap;            // Bit f set: first-level class f has a non-empty second-level class
+    uint32_t h_sl_bitmap[VM_HEAP_FL_COUNT]; // Bit s set: free list h_free[f][s] is non-empty
+    struct vm_heap_header *h_addr_root;     // Root of the address-ordered hole index (a treap)
+    struct vm_heap_header *h_addr_last;     // Highest-addressed hole, or NULL if there are no holes
     uint32_t h_addr_start;           // Start address of the heap's allocated space
     uint32_t h_addr_end;             // End address of the heap's allocated space
     uint32_t h_addr_max;             // Maximum address the heap can expand to
     int h_su;                        // Supervisor-only mapping flag (1: supervisor-only pages, 0: normal pages)
     int h_ro;                        // Read-only mapping flag (1: read-only pages, 0: writable pages)
+    int h_demand;                    // Demand paging flag (1: expand() only reserves pages, heap_fault() backs them)
+
+    // Statistics, maintained as the heap changes (see heap_stats)
+    uint32_t h_free_bytes;           // Bytes held in holes, including boundary tags
+    uint32_t h_holes;                // Number of holes in the index
+    uint32_t h_allocs;               // Number of successful alloc() calls
+    uint32_t h_frees;                // Number of free() calls
+    uint32_t h_expands;              // Number of times the heap was expanded
+    uint32_t h_contracts;            // Number of times the heap was contracted
+    uint32_t h_hist[VM_HEAP_HIST_BUCKETS]; // Histogram of allocation sizes
+};
+
+// Snapshot of a heap's usage and fragmentation, filled in by heap_stats()
+struct vm_heap_stats {
+    uint32_t hs_size;                // Current size of the heap
+    uint32_t hs_used;                // Bytes in allocated blocks, including boundary tags
+    uint32_t hs_free;                // Bytes in holes, including boundary tags
+    uint32_t hs_holes;               // Number of holes in the index
+    uint32_t hs_largest_hole;        // Size of the largest hole
+    uint32_t hs_frag;                // Fragmentation: percent of free bytes outside the largest hole
+    uint32_t hs_allocs;              // Number of successful alloc() calls
+    uint32_t hs_frees;               // Number of free() calls
+    uint32_t hs_expands;             // Number of times the heap was expanded
+    uint32_t hs_contracts;           // Number of times the heap was contracted
+    uint32_t hs_hist[VM_HEAP_HIST_BUCKETS]; // Histogram of allocation sizes
 };
 
 /*
@@ -85,6 +163,20 @@ struct vm_heap *init_heap(struct vm_heap *heap, uint32_t start, uint32_t end, ui
  */
 void *alloc(uint32_t size, int page_align, struct vm_heap *heap);
 
+/**
+ * Allocates a contiguous block of memory whose address is a multiple of `align`.
+ * 
+ * Any power of two is accepted. The slack in front of the block is returned to
+ * the heap, either as a hole of its own or by growing the block before it.
+ * 
+ * @param size The size of the memory block to allocate.
+ * @param align The required alignment (power of two, 0 for the default word alignment).
+ * @param heap A pointer to the heap structure where the memory should be allocated.
+ * 
+ * @return A pointer to the allocated memory block.
+ */
+void *alloc_aligned(uint32_t size, uint32_t align, struct vm_heap *heap);
+
 /**
  * Frees a block of memory previously allocated using `alloc`.
  * 
@@ -93,4 +185,78 @@ void *alloc(uint32_t size, int page_align, struct vm_heap *heap);
  */
 void free(void *p, struct vm_heap *heap);
 
+/**
+ * Allocates several blocks of the same size at once, carved out of a single hole.
+ * 
+ * @param size The size of each memory block.
+ * @param count The number of blocks to allocate.
+ * @param ptrs An array that receives the `count` block pointers.
+ * @param heap A pointer to the heap structure where the memory should be allocated.
+ */
+void alloc_bulk(uint32_t size, uint32_t count, void **ptrs, struct vm_heap *heap);
+
+/**
+ * Frees several blocks at once, coalescing neighbouring blocks in a single pass.
+ * 
+ * @param ptrs An array of blocks to free (reordered by the call; NULL entries are skipped).
+ * @param count The number of entries in `ptrs`.
+ * @param heap A pointer to the heap structure to which the memory belongs.
+ */
+void free_bulk(void **ptrs, uint32_t count, struct vm_heap *heap);
+
+/**
+ * Returns the number of usable bytes in a block returned by `alloc`.
+ * This may be more than was requested, since small remainders are
+ * handed to the block instead of being split off as holes.
+ * 
+ * @param p A pointer to the allocated block.
+ * @param heap A pointer to the heap structure to which the memory belongs.
+ * 
+ * @return The usable size of the block, in bytes.
+ */
+size_t alloc_size(void *p, struct vm_heap *heap);
+
+/**
+ * Backs a page of a demand-paged heap with a zeroed frame.
+ * 
+ * Called by the page fault handler for not-present faults. Only addresses
+ * between the start and the current end of a heap with `h_demand` set are
+ * handled.
+ * 
+ * @param address The faulting virtual address.
+ * @param heap A pointer to the heap structure (may be NULL).
+ * 
+ * @return 1 if the page was backed, 0 if the fault is not the heap's.
+ */
+int heap_fault(uint32_t address, struct vm_heap *heap);
+
+/**
+ * Backs every page of a range of a demand-paged heap.
+ * 
+ * Needed before the physical address of a block is handed out, since
+ * devices and the MMU never fault pages in. Thread stacks must be backed
+ * too (kmalloc_stack() does it): the page fault handler runs on the stack
+ * of the faulting thread, so a missing stack page ends in a double fault.
+ * 
+ * @param address The start of the range.
+ * @param len The length of the range, in bytes.
+ * @param heap A pointer to the heap structure the range belongs to.
+ */
+void heap_populate(uint32_t address, size_t len, struct vm_heap *heap);
+
+/**
+ * Takes a snapshot of the usage and fragmentation of a heap.
+ * 
+ * @param heap A pointer to the heap structure to inspect.
+ * @param stats A pointer to the structure that receives the snapshot.
+ */
+void heap_stats(struct vm_heap *heap, struct vm_heap_stats *stats);
+
+/**
+ * Prints the statistics of a heap to the screen.
+ * 
+ * @param heap A pointer to the heap structure to report on.
+ */
+void heap_dump(struct vm_heap *heap);
+
 #endif /* INCLUDE_HEAP_H */
@@ -2,14 +2,16 @@
 #include "descriptor_tables.h"
 #include "system.h"
 #include "screen.h"
+#include "scheduler.h"
 
-void keyboard_handler(struct regs *r);
+static void keyboard_handler(registers_t *regs);
 
 volatile char key_buffer[256];
 volatile int key_index = 0;
+static struct run_queue key_waiters;    // Threads blocked in wait_key()
 
 void init_keyboard() {
-    register_interrupt_handler(33, keyboard_handler); // IRQ1 = 33
+    register_interrupt_handler(IRQ1, keyboard_handler);
     outb(0x21, inb(0x21) & ~0x02); // Unmask IRQ1
 }
 
@@ -26,7 +28,7 @@ char scancode_to_ascii(unsigned char scancode) {
     return kbdus[scancode];
 }
 
-void keyboard_handler(struct regs *r) {
+static void keyboard_handler(registers_t *regs) {
     unsigned char scancode = inb(0x60);
     char key = scancode_to_ascii(scancode);
     if (key && key_index < 255) {
@@ -34,8 +36,12 @@ void keyboard_handler(struct regs *r) {
         key_buffer[key_index] = '\0';
     }
 
-    // Debug feedback on screen
-    screen_write_at("Key IRQ1", 0, 0);
+    // Wake every waiter: each one takes a key, or waits again if the others took them all
+    thread_t *t;
+    while ((t = key_waiters.rq_head) != NULL) {
+        rq_remove(t);
+        thread_wake(t);
+    }
 }
 
 char get_last_key() {
@@ -50,3 +56,19 @@ char get_last_key() {
 int is_key_ready() {
     return key_index > 0;
 }
+
+// Blocks until a key is available, instead of polling is_key_ready().
+// Only the keyboard handler may wake a waiting thread: it is on key_waiters.
+char wait_key() {
+    uint32_t flags = irq_save();
+    char key;
+
+    while (key_index == 0) {
+        rq_enqueue(&key_waiters, thread_current());
+        thread_block();
+    }
+    key = get_last_key();
+
+    irq_restore(flags);
+    return key;
+}
@@ -3,6 +3,7 @@
 
 void init_keyboard(void);
 char get_last_key(void);
+char wait_key(void);
 int is_key_ready(void);
 
 #endif
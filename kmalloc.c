@@ -4,6 +4,7 @@
 #include "paging.h"
 #include "heap.h"
 #include "kmalloc.h"
+#include "scheduler.h"
 
 // External references
 extern uint32_t __end;                          // End of the kernel (defined in the linker script)
@@ -13,11 +14,98 @@ extern struct vm_page_directory *kernel_directory; // Pointer to the kernel's pa
 uint32_t placement_address = (uint32_t)&__end;   // Address for placement-based allocation (initializes to the end of the kernel)
 
 /* Internal allocation routine */
-static void * _kmalloc(size_t len, uint32_t *phys, uint32_t flags);
+static void * _kmalloc(size_t len, uint32_t *phys, size_t align, uint32_t flags);
 
 /* Bitmask flags for _kmalloc() */
-#define M_ALIGNED  0x1  // Flag for requesting aligned memory
 #define M_ZERO      0x2  // Flag for requesting zeroed memory
+#define M_POPULATE  0x4  // Flag for requesting memory that never page faults
+
+/* Alignment of the page aligned variants */
+#define M_PAGE_ALIGN    0x1000
+
+/* Size of the blocks kept in magazine class `c` */
+#define KMAG_SIZE(c)    (1 << ((c) + KMAG_MIN_SHIFT))
+
+/*
+ * Locking:
+ * The kernel heap, and the magazines of the running thread, are only
+ * touched with interrupts disabled (irq_save/irq_restore). On a single CPU
+ * that keeps both the PIT-driven scheduler and interrupt handlers that
+ * allocate from running in the middle of an update.
+ */
+
+/**
+ * Returns the magazines of the running thread, creating them on first use.
+ * 
+ * @return The magazines, or NULL before threading has been initialized.
+ */
+static struct kmalloc_magazines *kmag_current(void)
+{
+    thread_t *t = thread_current();
+    struct kmalloc_magazines *mags;
+    uint32_t flags;
+
+    if (t == NULL)
+        return NULL;
+
+    if (t->mags == NULL) {
+        flags = irq_save();
+        mags = alloc(sizeof(struct kmalloc_magazines), 0, kernel_heap);
+        irq_restore(flags);
+
+        bzero(mags, sizeof(struct kmalloc_magazines));
+        t->mags = mags;
+    }
+
+    return t->mags;
+}
+
+/**
+ * Allocates a block from the running thread's magazine of class `c`.
+ * An empty magazine is refilled with KMAG_BATCH blocks in one heap visit.
+ * 
+ * @param mags The magazines of the running thread.
+ * @param c The size class.
+ * @return A block of at least KMAG_SIZE(c) bytes.
+ */
+static void * kmag_alloc(struct kmalloc_magazines *mags, uint32_t c)
+{
+    struct kmag *mag = &mags->km_mags[c];
+    uint32_t flags = irq_save();
+    void *addr;
+
+    if (mag->m_count == 0) {
+        alloc_bulk(KMAG_SIZE(c), KMAG_BATCH, mag->m_rounds, kernel_heap);
+        mag->m_count = KMAG_BATCH;
+    }
+    addr = mag->m_rounds[--mag->m_count];
+
+    irq_restore(flags);
+
+    return addr;
+}
+
+/**
+ * Returns a block to the running thread's magazine of class `c`.
+ * A full magazine first flushes KMAG_BATCH blocks back to the heap in one visit.
+ * 
+ * @param mags The magazines of the running thread.
+ * @param c The size class.
+ * @param ptr The block to cache.
+ */
+static void kmag_free(struct kmalloc_magazines *mags, uint32_t c, void *ptr)
+{
+    struct kmag *mag = &mags->km_mags[c];
+    uint32_t flags = irq_save();
+
+    if (mag->m_count == KMAG_ROUNDS) {
+        mag->m_count -= KMAG_BATCH;
+        free_bulk(&mag->m_rounds[mag->m_count], KMAG_BATCH, kernel_heap);
+    }
+    mag->m_rounds[mag->m_count++] = ptr;
+
+    irq_restore(flags);
+}
 
 
 /**
@@ -28,7 +116,7 @@ static void * _kmalloc(size_t len, uint32_t *phys, uint32_t flags);
  */
 void * kmalloc(size_t len)
 {
-    return _kmalloc(len, NULL, 0);
+    return _kmalloc(len, NULL, 0, 0);
 }
 
 /**
@@ -39,7 +127,7 @@ void * kmalloc(size_t len)
  */
 void * kmalloc0(size_t len)
 {
-    return _kmalloc(len, NULL, M_ZERO);
+    return _kmalloc(len, NULL, 0, M_ZERO);
 }
 
 /**
@@ -50,7 +138,7 @@ void * kmalloc0(size_t len)
  */
 void * kmalloc_a(size_t len)
 {
-    return _kmalloc(len, NULL, M_ALIGNED);
+    return _kmalloc(len, NULL, M_PAGE_ALIGN, 0);
 }
 
 /**
@@ -61,7 +149,19 @@ void * kmalloc_a(size_t len)
  */
 void * kmalloc0_a(size_t len)
 {
-    return _kmalloc(len, NULL, (M_ALIGNED | M_ZERO));
+    return _kmalloc(len, NULL, M_PAGE_ALIGN, M_ZERO);
+}
+
+/**
+ * Allocates memory from the heap at an arbitrary alignment.
+ * 
+ * @param len The size of memory to allocate.
+ * @param align The required alignment (power of two).
+ * @return A pointer to the allocated memory (aligned).
+ */
+void * kmalloc_aligned(size_t len, size_t align)
+{
+    return _kmalloc(len, NULL, align, 0);
 }
 
 /**
@@ -73,7 +173,7 @@ void * kmalloc0_a(size_t len)
  */
 void * kmalloc_p(size_t len, uint32_t *phys)
 {
-    return _kmalloc(len, phys, 0);
+    return _kmalloc(len, phys, 0, 0);
 }
 
 /**
@@ -85,7 +185,7 @@ void * kmalloc_p(size_t len, uint32_t *phys)
  */
 void * kmalloc0_p(size_t len, uint32_t *phys)
 {
-    return _kmalloc(len, phys, M_ZERO);
+    return _kmalloc(len, phys, 0, M_ZERO);
 }
 
 /**
@@ -97,7 +197,7 @@ void * kmalloc0_p(size_t len, uint32_t *phys)
  */
 void * kmalloc_ap(size_t len, uint32_t *phys)
 {
-    return _kmalloc(len, phys, M_ALIGNED);
+    return _kmalloc(len, phys, M_PAGE_ALIGN, 0);
 }
 
 /**
@@ -109,7 +209,20 @@ void * kmalloc_ap(size_t len, uint32_t *phys)
  */
 void * kmalloc0_ap(size_t len, uint32_t *phys)
 {
-    return _kmalloc(len, phys, (M_ALIGNED | M_ZERO));
+    return _kmalloc(len, phys, M_PAGE_ALIGN, M_ZERO);
+}
+
+/**
+ * Allocates memory for a thread stack.
+ * 
+ * Every page of the block is backed up front (see heap_populate()).
+ * 
+ * @param len The size of the stack.
+ * @return A pointer to the bottom of the stack.
+ */
+void * kmalloc_stack(size_t len)
+{
+    return _kmalloc(len, NULL, 0, M_POPULATE);
 }
 
 /**
@@ -120,19 +233,19 @@ void * kmalloc0_ap(size_t len, uint32_t *phys)
  * 
  * @param len The size of memory to allocate.
  * @param phys A pointer to store the physical address of the allocated memory (can be NULL).
- * @param flags Flags for additional memory properties (alignment and zero initialization).
+ * @param align The required alignment (power of two, 0 for no particular alignment).
+ * @param flags Flags for additional memory properties (zero initialization, populating).
  * @return A pointer to the allocated memory.
  */
-static void * _kmalloc(size_t len, uint32_t *phys, uint32_t flags)
+static void * _kmalloc(size_t len, uint32_t *phys, size_t align, uint32_t flags)
 {
     void *addr = NULL;
 
     // If no kernel heap is available, allocate from the placement address
     if (kernel_heap == NULL) {
         // Ensure the address is aligned if requested
-        if ((flags & M_ALIGNED) && (placement_address & 0xFFFFF000)) {
-            placement_address = (placement_address & 0xFFFFF000) + 0x1000; // Align to next 4KB boundary
-        }
+        if (align > 1)
+            placement_address = (placement_address + align - 1) & ~(align - 1);
 
         // Return physical address if requested
         if (phys != NULL)
@@ -142,14 +255,32 @@ static void * _kmalloc(size_t len, uint32_t *phys, uint32_t flags)
         placement_address += len;
         addr = (void *)(placement_address - len);
     } else {
-        // Otherwise, allocate memory from the kernel heap
-        addr = alloc(len, (flags & M_ALIGNED), kernel_heap);
+        struct kmalloc_magazines *mags = NULL;
 
-        // Return the physical address if requested
-        if (phys != NULL) {
-            struct vm_page *page = get_page((uint32_t)addr, 0, kernel_directory);
-            *phys = page->p_frame * 0x1000 + ((uint32_t)addr & 0xFFF);
+        // Small unaligned requests are served by the running thread's magazines
+        if (align <= 4 && len <= KMAG_SIZE(KMAG_CLASSES - 1))
+            mags = kmag_current();
+
+        if (mags != NULL) {
+            uint32_t c = (len <= KMAG_SIZE(0)) ? 0 : (32 - __builtin_clz(len - 1)) - KMAG_MIN_SHIFT;
+            addr = kmag_alloc(mags, c);
+        } else {
+            // Otherwise, allocate memory from the kernel heap
+            uint32_t irq = irq_save();
+            addr = alloc_aligned(len, align, kernel_heap);
+            irq_restore(irq);
+        }
+
+        // Back the whole block first if whoever uses it can't fault it in
+        if (phys != NULL || (flags & M_POPULATE)) {
+            uint32_t irq = irq_save();
+            heap_populate((uint32_t)addr, len, kernel_heap);
+            irq_restore(irq);
         }
+
+        // Return the physical address if requested
+        if (phys != NULL)
+            *phys = virt_to_phys((uint32_t)addr, kernel_directory);
     }
 
     // Zero the memory if the M_ZERO flag is set
@@ -159,6 +290,48 @@ static void * _kmalloc(size_t len, uint32_t *phys, uint32_t flags)
     return addr;
 }
 
+/**
+ * Allocates several blocks of the same size from the heap in one visit.
+ * 
+ * The blocks bypass the magazines and are carved out of a single hole, so
+ * they can be given back together with kfree_bulk().
+ * 
+ * @param len The size of each block.
+ * @param n The number of blocks to allocate.
+ * @param ptrs An array that receives the `n` block pointers.
+ */
+void kmalloc_bulk(size_t len, uint32_t n, void **ptrs)
+{
+    uint32_t flags;
+    uint32_t i;
+
+    // Before the heap exists, fall back to the placement allocator
+    if (kernel_heap == NULL) {
+        for (i = 0; i < n; i++)
+            ptrs[i] = kmalloc(len);
+        return;
+    }
+
+    flags = irq_save();
+    alloc_bulk(len, n, ptrs, kernel_heap);
+    irq_restore(flags);
+}
+
+/**
+ * Frees several blocks back to the heap in one visit.
+ * 
+ * Neighbouring blocks are coalesced in a single pass. The array is reordered.
+ * 
+ * @param ptrs The blocks to free (NULL entries are skipped).
+ * @param n The number of entries in `ptrs`.
+ */
+void kfree_bulk(void **ptrs, uint32_t n)
+{
+    uint32_t flags = irq_save();
+    free_bulk(ptrs, n, kernel_heap);
+    irq_restore(flags);
+}
+
 /**
  * Frees the allocated memory back to the heap.
  * 
@@ -166,5 +339,25 @@ static void * _kmalloc(size_t len, uint32_t *phys, uint32_t flags)
  */
 void kfree(void *ptr)
 {
+    struct kmalloc_magazines *mags;
+    uint32_t flags;
+
+    if (ptr == NULL)
+        return;
+
+    // Cache the block in the magazine of the largest class it can serve
+    mags = kmag_current();
+    if (mags != NULL) {
+        size_t size = alloc_size(ptr, kernel_heap);
+        int32_t c = (31 - __builtin_clz(size)) - KMAG_MIN_SHIFT;
+
+        if (c >= 0 && c < KMAG_CLASSES) {
+            kmag_free(mags, c, ptr);
+            return;
+        }
+    }
+
+    flags = irq_save();
     free(ptr, kernel_heap);
+    irq_restore(flags);
 }
@@ -9,6 +9,29 @@
  * with 0x0 (zeroed out).
  */
 
+/*
+ * Per-thread magazines:
+ * Each thread keeps a small stack ("magazine") of free blocks for each of
+ * the KMAG_CLASSES power-of-two size classes, so that a kmalloc/kfree pair
+ * of a small size never has to touch the shared kernel heap. Magazines are
+ * refilled from, and flushed to, the heap KMAG_BATCH blocks at a time.
+ */
+#define KMAG_MIN_SHIFT  4       /* log2 of the smallest class size (16 bytes) */
+#define KMAG_CLASSES    5       /* Classes of 16, 32, 64, 128 and 256 bytes */
+#define KMAG_ROUNDS     16      /* Blocks one magazine can hold */
+#define KMAG_BATCH      8       /* Blocks moved between a magazine and the heap at once */
+
+/* A magazine of free blocks of one size class */
+struct kmag {
+    uint32_t m_count;                   /* Number of blocks in the magazine */
+    void *m_rounds[KMAG_ROUNDS];        /* The blocks, used as a stack */
+};
+
+/* The magazines owned by one thread */
+struct kmalloc_magazines {
+    struct kmag km_mags[KMAG_CLASSES];
+};
+
 /**
  * @brief Allocates a block of memory of the specified length.
  * 
@@ -42,6 +65,15 @@ void *kmalloc_a(size_t len);  /* page aligned malloc */
  */
 void *kmalloc0_a(size_t len);
 
+/**
+ * @brief Allocates a block of memory of the specified length, aligned to any power of two.
+ * 
+ * @param len The size of the memory block to allocate, in bytes.
+ * @param align The required alignment, in bytes (power of two).
+ * @return A pointer to the allocated memory block, aligned to `align`, or NULL if the allocation fails.
+ */
+void *kmalloc_aligned(size_t len, size_t align);
+
 /**
  * @brief Allocates a block of memory of the specified length and returns its physical address.
  * 
@@ -81,6 +113,31 @@ void *kmalloc_ap(size_t len, uint32_t *phys);  /* page aligned and physical addr
  */
 void *kmalloc0_ap(size_t len, uint32_t *phys);
 
+/**
+ * @brief Allocates a thread stack, with every page backed up front.
+ * 
+ * @param len The size of the stack, in bytes.
+ * @return A pointer to the bottom of the stack, or NULL if the allocation fails.
+ */
+void *kmalloc_stack(size_t len);
+
+/**
+ * @brief Allocates several blocks of memory of the same length at once.
+ * 
+ * @param len The size of each memory block, in bytes.
+ * @param n The number of blocks to allocate.
+ * @param ptrs An array that receives the `n` pointers to the allocated blocks.
+ */
+void kmalloc_bulk(size_t len, uint32_t n, void **ptrs);
+
+/**
+ * @brief Frees several previously allocated blocks of memory at once.
+ * 
+ * @param ptrs An array of pointers to the memory blocks to free (reordered by the call).
+ * @param n The number of entries in `ptrs`.
+ */
+void kfree_bulk(void **ptrs, uint32_t n);
+
 /**
  * @brief Frees a previously allocated block of memory.
  * 
@@ -1,4 +1,5 @@
 #include "system.h"
+#include "multiboot.h"
 #include "descriptor_tables.h"
 #include "paging.h"
 #include "heap.h"
@@ -7,6 +8,7 @@
 #include "thread.h"
 #include "scheduler.h"
 #include "timer.h"
+#include "keyboard.h"
 
 
 int fn(void *arg) {
@@ -14,21 +16,38 @@ int fn(void *arg) {
         int i;
         for (i = 0; i < 80; i++) {
             printk("a = %d\n", i);
+            thread_sleep(1);    // Leave the CPU to the others until the next tick
         }
     }
     return 6;
 }
 
-int main(void *mboot_ptr) {
+// Echoes the keys typed, sleeping in wait_key() in between
+int key_reader(void *arg) {
+    for (;;)
+        printk("key: %c\n", wait_key());
+    return 0;
+}
+
+int main(struct multiboot_info *mboot_ptr) {
     init_descriptor_tables();
-    init_paging();
+    init_paging(mboot_ptr);
     init_timer(20);
+    init_keyboard();
 
     asm volatile ("sti");
     init_scheduler(init_threading());
 
-    uint32_t *stack = kmalloc(0x400) + 0x3F0;
+    uint32_t *stack = kmalloc_stack(0x400) + 0x3F0;
     thread_t *t = create_thread(&fn, (void *)0x567, stack);
+
+    // Zero free frames in the background when nothing else is ready, for alloc_frame_zeroed()
+    uint32_t *zero_stack = kmalloc_stack(0x400) + 0x3F0;
+    thread_t *zero_thread = create_thread(&zero_pool_thread, NULL, zero_stack);
+    thread_set_idle(zero_thread);
+
+    uint32_t *key_stack = kmalloc_stack(0x400) + 0x3F0;
+    create_thread(&key_reader, NULL, key_stack);
    
 
     for (;;) {
@@ -0,0 +1,61 @@
+#ifndef MULTIBOOT_H
+#define MULTIBOOT_H
+
+#include "type.h"
+
+/*
+ * Multiboot (version 1) boot information, as passed in ebx by the boot
+ * loader and handed to main() by boot.s. Only the fields the kernel uses
+ * are documented; see the Multiboot Specification for the rest.
+ */
+
+/* Bits of mi_flags telling which fields are valid */
+#define MULTIBOOT_INFO_MEMORY       0x001   /* mi_mem_lower and mi_mem_upper */
+#define MULTIBOOT_INFO_MEM_MAP      0x040   /* mi_mmap_length and mi_mmap_addr */
+
+/* Types of memory map entries */
+#define MULTIBOOT_MEMORY_AVAILABLE  1       /* Usable RAM; every other type is reserved */
+#define MULTIBOOT_MEMORY_RESERVED   2       /* Reserved by the firmware or devices */
+#define MULTIBOOT_MEMORY_ACPI       3       /* ACPI tables, reclaimable once parsed */
+#define MULTIBOOT_MEMORY_NVS        4       /* ACPI non-volatile storage */
+#define MULTIBOOT_MEMORY_BADRAM     5       /* Defective RAM */
+
+/* Boot information structure */
+struct multiboot_info {
+    uint32_t mi_flags;          /* Which of the fields below are valid */
+    uint32_t mi_mem_lower;      /* KB of memory below 1MB */
+    uint32_t mi_mem_upper;      /* KB of memory above 1MB, up to the first hole */
+    uint32_t mi_boot_device;
+    uint32_t mi_cmdline;
+    uint32_t mi_mods_count;
+    uint32_t mi_mods_addr;
+    uint32_t mi_syms[4];
+    uint32_t mi_mmap_length;    /* Size of the memory map, in bytes */
+    uint32_t mi_mmap_addr;      /* Physical address of the first memory map entry */
+    uint32_t mi_drives_length;
+    uint32_t mi_drives_addr;
+    uint32_t mi_config_table;
+    uint32_t mi_boot_loader_name;
+    uint32_t mi_apm_table;
+    uint32_t mi_vbe_control_info;
+    uint32_t mi_vbe_mode_info;
+    uint16_t mi_vbe_mode;
+    uint16_t mi_vbe_interface_seg;
+    uint16_t mi_vbe_interface_off;
+    uint16_t mi_vbe_interface_len;
+} __attribute__((packed));
+
+/*
+ * Memory map entry. Entries are of variable size: the next one starts
+ * mm_size + 4 bytes after the current one.
+ */
+struct multiboot_mmap_entry {
+    uint32_t mm_size;           /* Size of the entry, not counting this field */
+    uint32_t mm_base_low;       /* Start of the region (low 32 bits) */
+    uint32_t mm_base_high;      /* Start of the region (high 32 bits) */
+    uint32_t mm_length_low;     /* Length of the region (low 32 bits) */
+    uint32_t mm_length_high;    /* Length of the region (high 32 bits) */
+    uint32_t mm_type;           /* MULTIBOOT_MEMORY_* */
+} __attribute__((packed));
+
+#endif /* MULTIBOOT_H */
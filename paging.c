@@ -1,8 +1,10 @@
 #include "paging.h"
 #include "heap.h"
 #include "kmalloc.h"
+#include "multiboot.h"
+#include "scheduler.h"
 
-/* A bitset of frames - used or free. */
+/* A bitset of frames - used or free. Allocation itself goes through the buddy maps below. */
 uint32_t *frames;
 uint32_t nframes;
 
@@ -14,6 +16,66 @@ struct vm_page_directory *kernel_directory;
 /* The current page directory */
 struct vm_page_directory *current_directory;
 
+/*
+ * Page tables are not kept at a virtual address of their own: before paging
+ * is enabled they are reached at their (identity) physical address, and
+ * after, through the recursive mapping of the directory they belong to.
+ * foreign_directory is the directory that the current directory's
+ * PDE_FOREIGN entry points at, if any.
+ */
+static int paging_enabled;
+static struct vm_page_directory *foreign_directory;
+
+/*
+ * Page tables are frames of their own, not heap blocks: once paging is
+ * enabled they come from the pre-zeroed frame pool, and are never touched
+ * through anything but the recursive mapping and the kmap window. Before,
+ * they come from the identity-mapped placement memory.
+ */
+static uint32_t page_tables;        /* Page tables created, in all directories */
+
+/*
+ * 4MB pages (PSE):
+ * When the CPU supports them, whole 4MB chunks of the identity map and of
+ * ranges backed by vm_map_range() are mapped by a single page directory
+ * entry with PDE_LARGE set, instead of a page table of 1024 entries. A large
+ * page is split back into a page table as soon as get_page() is asked for
+ * one of its 4KB pages.
+ */
+static int pse_enabled;             /* CPUID reported PSE and CR4.PSE is set */
+static uint32_t large_pages;        /* 4MB mappings currently in use */
+static uint32_t large_splits;       /* 4MB mappings split into page tables */
+
+/*
+ * Global pages (PGE):
+ * Everything mapped in the kernel directory is part of every address space,
+ * so it is mapped with the global bit set and stays in the TLB when CR3 is
+ * reloaded. Such entries are only dropped by invlpg or by tlb_flush_all().
+ */
+static int pge_enabled;             /* CPUID reported PGE */
+
+/*
+ * Copy-on-write:
+ * clone_directory() shares the frames of private pages between the two
+ * address spaces instead of copying them. frame_refs[frame] counts the
+ * extra page entries that map a frame, so a frame is only given back to the
+ * allocator by the last one. Shared writeable pages are mapped read-only with
+ * p_cow set, and CR0.WP makes the kernel's own writes to them fault too.
+ */
+static uint16_t *frame_refs;
+static struct vm_page *kmap_page;   /* The page entry of VM_KMAP_WINDOW */
+
+/*
+ * Pre-zeroed frames:
+ * zero_pool_thread() zeroes free frames while the CPU has nothing better to
+ * do, so that alloc_frame_zeroed() seldom has to. The pool and the kmap
+ * window are only used with interrupts disabled.
+ */
+static uint32_t zero_pool[VM_ZERO_POOL_SIZE];
+static uint32_t zero_pool_count;
+static uint32_t zero_pool_hits;     /* alloc_frame_zeroed() calls served by the pool */
+static uint32_t zero_pool_misses;   /* alloc_frame_zeroed() calls that zeroed a frame */
+
 /* Macros used in the bitset algorithms. */
 #define INDEX_FROM_BIT(a)  ((a) / (8 * 4))          /* Convert frame number to bitset index */
 #define OFFSET_FROM_BIT(a) ((a) % (8 * 4))          /* Calculate bit position within the bitset */
@@ -50,7 +112,6 @@ static void clear_frame(uint32_t frame_addr) {
  * @param frame_addr The address of the frame to test.
  * @return 1 if the frame is allocated, 0 if it's free.
  */
-__attribute__((__unused__))  /* This function is unused but may be useful for debugging */
 static uint32_t test_frame(uint32_t frame_addr) {
     uint32_t frame = frame_addr / 0x1000;          /* Convert frame address to frame index */
     uint32_t idx = INDEX_FROM_BIT(frame);          /* Get the index in the bitset */
@@ -59,28 +120,339 @@ static uint32_t test_frame(uint32_t frame_addr) {
     return (frames[idx] & (0x1 << off));           /* Return 1 if the bit is set, 0 if not */
 }
 
+/*
+ * Binary buddy allocator:
+ * Free physical memory is kept as naturally aligned blocks of 2^order frames.
+ * buddy_map[order] has one bit per block of that order, set while the block is
+ * free, and buddy_count[order] counts the set bits. A block and its buddy
+ * (block ^ (1 << order)) merge into one block of the next order when both are free.
+ *
+ * buddy_summary[order] has one bit per word of buddy_map[order], set while the
+ * word has a free block, so a free block is found with two bit scans.
+ * buddy_hint[order] is the summary word where the last search succeeded.
+ */
+static uint32_t *buddy_map[FRAME_MAX_ORDER + 1];
+static uint32_t *buddy_summary[FRAME_MAX_ORDER + 1];
+static uint32_t buddy_count[FRAME_MAX_ORDER + 1];
+static uint32_t buddy_hint[FRAME_MAX_ORDER + 1];
+
 /**
- * @brief Finds the first free frame in the bitset.
+ * @brief Marks a block as free in the buddy maps.
  *
- * @return The frame index of the first free frame, or -1 if no frames are free.
+ * @param frame The first frame of the block.
+ * @param order The order of the block.
  */
-static uint32_t first_frame(void) {
-    uint32_t i, j;
+static void buddy_put(uint32_t frame, uint32_t order) {
+    uint32_t bit = frame >> order;
+    uint32_t idx = INDEX_FROM_BIT(bit);
 
-    for (i = 0; i < INDEX_FROM_BIT(nframes); i++) {
-        if (frames[i] == 0xFFFFFFFF) {
-            /* No free frames in this section, continue to next bitset */
-            continue;
+    buddy_map[order][idx] |= (0x1 << OFFSET_FROM_BIT(bit));
+    buddy_summary[order][INDEX_FROM_BIT(idx)] |= (0x1 << OFFSET_FROM_BIT(idx));
+    buddy_count[order]++;
+}
+
+/**
+ * @brief Removes a free block from the buddy maps.
+ *
+ * @param frame The first frame of the block.
+ * @param order The order of the block.
+ */
+static void buddy_take(uint32_t frame, uint32_t order) {
+    uint32_t bit = frame >> order;
+    uint32_t idx = INDEX_FROM_BIT(bit);
+
+    buddy_map[order][idx] &= ~(0x1 << OFFSET_FROM_BIT(bit));
+    if (buddy_map[order][idx] == 0)
+        buddy_summary[order][INDEX_FROM_BIT(idx)] &= ~(0x1 << OFFSET_FROM_BIT(idx));
+    buddy_count[order]--;
+}
+
+/**
+ * @brief Tests whether a block is free at the given order.
+ *
+ * @param frame The first frame of the block.
+ * @param order The order of the block.
+ * @return Non-zero if the block is free.
+ */
+static uint32_t buddy_test(uint32_t frame, uint32_t order) {
+    uint32_t bit = frame >> order;
+
+    return (buddy_map[order][INDEX_FROM_BIT(bit)] & (0x1 << OFFSET_FROM_BIT(bit)));
+}
+
+/**
+ * @brief Finds a free block of the given order.
+ *
+ * The summary words are scanned from the hint onwards, wrapping around; one
+ * summary word covers 1024 blocks, so this usually looks at a single word.
+ *
+ * @param order The order to search; buddy_count[order] must be non-zero.
+ * @return The first frame of a free block.
+ */
+static uint32_t buddy_find(uint32_t order) {
+    uint32_t words = INDEX_FROM_BIT(INDEX_FROM_BIT(nframes >> order)) + 1;
+    uint32_t s = buddy_hint[order];
+    uint32_t idx;
+
+    while (buddy_summary[order][s] == 0)
+        s = (s + 1 < words) ? s + 1 : 0;
+    buddy_hint[order] = s;
+
+    idx = s * 4 * 8 + __builtin_ctz(buddy_summary[order][s]);
+    return ((idx * 4 * 8 + __builtin_ctz(buddy_map[order][idx])) << order);
+}
+
+/**
+ * @brief Allocates 2^order physically contiguous frames.
+ *
+ * The smallest free block of at least that order is split, and the unused
+ * upper halves are handed back to the lower orders.
+ *
+ * @param order The order of the allocation (0 to FRAME_MAX_ORDER).
+ * @return The physical address of the first frame, or -1 if no block is large enough.
+ */
+uint32_t alloc_frames(uint32_t order) {
+    uint32_t k, frame, i;
+
+    kassert("order in range", order <= FRAME_MAX_ORDER);
+
+    for (k = order; k <= FRAME_MAX_ORDER && buddy_count[k] == 0; k++)
+        ;
+    if (k > FRAME_MAX_ORDER)
+        return (-1);
+
+    frame = buddy_find(k);
+    buddy_take(frame, k);
+
+    /* Split the block down to the requested order */
+    while (k > order) {
+        k--;
+        buddy_put(frame + (1 << k), k);
+    }
+
+    for (i = 0; i < (1 << order); i++)
+        set_frame((frame + i) * 0x1000);
+
+    return (frame * 0x1000);
+}
+
+/**
+ * @brief Frees 2^order physically contiguous frames.
+ *
+ * The block is merged with its buddy for as long as the buddy is free too.
+ *
+ * @param addr The physical address of the first frame.
+ * @param order The order the block was allocated with.
+ */
+void free_frames(uint32_t addr, uint32_t order) {
+    uint32_t frame = addr / 0x1000;
+    uint32_t i;
+
+    kassert("order in range", order <= FRAME_MAX_ORDER);
+    kassert("block is aligned to its order", (frame & ((1 << order) - 1)) == 0);
+
+    for (i = 0; i < (1 << order); i++) {
+        kassert("frame is allocated", test_frame((frame + i) * 0x1000));
+        clear_frame((frame + i) * 0x1000);
+    }
+
+    /* Merge with free buddies */
+    while (order < FRAME_MAX_ORDER) {
+        uint32_t buddy = frame ^ (1 << order);
+        if (buddy + (1 << order) > nframes || !buddy_test(buddy, order))
+            break;
+        buddy_take(buddy, order);
+        frame &= ~(1 << order);
+        order++;
+    }
+
+    buddy_put(frame, order);
+}
+
+/**
+ * @brief Takes one specific frame out of the buddy allocator.
+ *
+ * The free block that contains the frame is split around it.
+ *
+ * @param frame The frame index to reserve.
+ * @return 1 if the frame was free and is now allocated, 0 if it was already in use.
+ */
+static int reserve_frame(uint32_t frame) {
+    uint32_t k, base;
+
+    /* Find the free block that holds the frame */
+    for (k = 0; k <= FRAME_MAX_ORDER; k++) {
+        base = frame & ~((1 << k) - 1);
+        if (base + (1 << k) <= nframes && buddy_test(base, k))
+            break;
+    }
+    if (k > FRAME_MAX_ORDER)
+        return (0);
+
+    buddy_take(base, k);
+
+    /* Split it, keeping the half that holds the frame */
+    while (k > 0) {
+        k--;
+        if (frame >= base + (1 << k)) {
+            buddy_put(base, k);
+            base += (1 << k);
+        } else {
+            buddy_put(base + (1 << k), k);
+        }
+    }
+
+    set_frame(frame * 0x1000);
+    return (1);
+}
+
+/**
+ * @brief Creates the buddy maps and hands frames [0, nframes) to the allocator.
+ */
+static void init_frames(void) {
+    uint32_t k, frame;
+
+    frames = kmalloc0((INDEX_FROM_BIT(nframes) + 1) * sizeof(uint32_t));
+    frame_refs = kmalloc0(nframes * sizeof(uint16_t));
+    for (k = 0; k <= FRAME_MAX_ORDER; k++) {
+        buddy_map[k] = kmalloc0((INDEX_FROM_BIT(nframes >> k) + 1) * sizeof(uint32_t));
+        buddy_summary[k] = kmalloc0((INDEX_FROM_BIT(INDEX_FROM_BIT(nframes >> k)) + 1) * sizeof(uint32_t));
+        buddy_count[k] = 0;
+        buddy_hint[k] = 0;
+    }
+
+    /* Seed the allocator with the largest aligned blocks that fit */
+    frame = 0;
+    while (frame < nframes) {
+        k = FRAME_MAX_ORDER;
+        while ((frame & ((1 << k) - 1)) != 0 || frame + (1 << k) > nframes)
+            k--;
+        buddy_put(frame, k);
+        frame += (1 << k);
+    }
+}
+
+/*
+ * Usable RAM, in frames, as reported by the boot loader. The regions are
+ * copied out of the multiboot information before anything is allocated,
+ * since the boot loader may have placed it right after the kernel.
+ */
+#define MEM_REGIONS_MAX 32
+static struct {
+    uint32_t start;     /* First frame of the region */
+    uint32_t end;       /* First frame past the region */
+} mem_regions[MEM_REGIONS_MAX];
+static uint32_t mem_nregions;
+
+/**
+ * @brief Records a region of usable RAM, trimmed to whole frames below 4GB.
+ *
+ * @param base The physical start of the region.
+ * @param length The length of the region, in bytes (0 for "up to 4GB").
+ */
+static void add_mem_region(uint32_t base, uint32_t length) {
+    uint32_t start = base / 0x1000 + ((base & 0xFFF) != 0);
+    uint32_t end = (length == 0 || base + length < base) ? 0x100000 : (base + length) / 0x1000;
+
+    if (end > start && mem_nregions < MEM_REGIONS_MAX) {
+        mem_regions[mem_nregions].start = start;
+        mem_regions[mem_nregions].end = end;
+        mem_nregions++;
+    }
+}
+
+/**
+ * @brief Reads the usable RAM out of the multiboot information.
+ *
+ * The full memory map is used when the boot loader provides one; otherwise
+ * mem_lower/mem_upper, and failing that, 16MB is assumed.
+ *
+ * @param mbi The multiboot information (may be NULL).
+ * @return The number of frames up to the end of the highest usable region.
+ */
+static uint32_t read_memory_map(struct multiboot_info *mbi) {
+    uint32_t addr, i, end = 0;
+
+    mem_nregions = 0;
+
+    if (mbi != NULL && (mbi->mi_flags & MULTIBOOT_INFO_MEM_MAP)) {
+        addr = mbi->mi_mmap_addr;
+        while (addr < mbi->mi_mmap_addr + mbi->mi_mmap_length) {
+            struct multiboot_mmap_entry *e = (struct multiboot_mmap_entry *)addr;
+
+            /* Only usable RAM below 4GB can be mapped by a 32-bit kernel */
+            if (e->mm_type == MULTIBOOT_MEMORY_AVAILABLE && e->mm_base_high == 0)
+                add_mem_region(e->mm_base_low, e->mm_length_high ? 0 : e->mm_length_low);
+
+            addr += e->mm_size + sizeof(e->mm_size);
         }
-        /* At least one bit is free in this section */
-        for (j = 0; j < 32; j++) {
-            if ((frames[i] & (0x1 << j)) == 0) {
-                /* Found the first free frame */
-                return (i * 4 * 8 + j);
+    } else if (mbi != NULL && (mbi->mi_flags & MULTIBOOT_INFO_MEMORY)) {
+        add_mem_region(0, mbi->mi_mem_lower * 1024);
+        add_mem_region(0x100000, mbi->mi_mem_upper * 1024);
+    } else {
+        add_mem_region(0, 0x1000000);
+    }
+
+    for (i = 0; i < mem_nregions; i++) {
+        if (mem_regions[i].end > end)
+            end = mem_regions[i].end;
+    }
+
+    return (end);
+}
+
+/**
+ * @brief Takes every frame that is not usable RAM out of the allocator.
+ *
+ * Reserved, ACPI and unlisted ranges below the highest usable frame are
+ * marked as used, so that they are never handed out.
+ */
+static void reserve_unusable_frames(void) {
+    uint32_t frame = 0, next, end, i;
+
+    while (frame < nframes) {
+        /* Find the first usable frame at or above this one, and where its region ends */
+        next = nframes;
+        end = nframes;
+        for (i = 0; i < mem_nregions; i++) {
+            uint32_t start = (mem_regions[i].start > frame) ? mem_regions[i].start : frame;
+            if (mem_regions[i].end > frame && start < next) {
+                next = start;
+                end = mem_regions[i].end;
             }
         }
+
+        /* Reserve the gap in front of it, then skip the usable region */
+        for (; frame < next; frame++)
+            reserve_frame(frame);
+        frame = end;
     }
-    return (-1);  /* No free frame found */
+}
+
+/**
+ * @brief Converts the is_kernel/is_writeable pair used by the frame functions to VM_* flags.
+ *
+ * @param is_kernel Flag to specify if the page is for the kernel (1) or user (0).
+ * @param is_writeable Flag to specify if the page should be writeable (1) or read-only (0).
+ * @return The VM_WRITE and VM_USER flags.
+ */
+static uint32_t vm_flags(int is_kernel, int is_writeable) {
+    return ((is_writeable) ? VM_WRITE : 0) | ((is_kernel) ? 0 : VM_USER);
+}
+
+/**
+ * @brief Points a page at a frame, with the given VM_* flags.
+ *
+ * @param p The page to set.
+ * @param frame_addr The physical address of the frame.
+ * @param flags VM_WRITE, VM_USER and VM_GLOBAL.
+ */
+static void set_page(struct vm_page *p, uint32_t frame_addr, uint32_t flags) {
+    p->p_present = 1;
+    p->p_frame = frame_addr / 0x1000;
+    p->p_rw = (flags & VM_WRITE) ? 1 : 0;
+    p->p_user = (flags & VM_USER) ? 1 : 0;
+    p->p_global = (pge_enabled && (flags & VM_GLOBAL)) ? 1 : 0;
 }
 
 /**
@@ -91,19 +463,15 @@ static uint32_t first_frame(void) {
  * @param is_writeable Flag to specify if the page should be writeable (1) or read-only (0).
  */
 void alloc_frame(struct vm_page *p, int is_kernel, int is_writeable) {
-    uint32_t idx;
+    uint32_t addr;
 
     if (p->p_frame != 0) return; /* Frame already allocated, return immediately */
 
-    idx = first_frame();  /* Get the first free frame index */
-    if (idx == -1)
+    addr = alloc_frames(0);  /* Take a single frame from the buddy allocator */
+    if (addr == -1)
         panic("No free frame.");
 
-    set_frame(idx * 0x1000);  /* Mark this frame as allocated */
-    p->p_present = 1;         /* Mark the page as present */
-    p->p_frame = idx;
-    p->p_rw = (is_writeable) ? 1 : 0; /* Set read/write flag */
-    p->p_user = (is_kernel) ? 0 : 1; /* Set user-mode/kernel-mode flag */
+    set_page(p, addr, vm_flags(is_kernel, is_writeable));
 }
 
 /**
@@ -115,29 +483,696 @@ void free_frame(struct vm_page *p) {
     if (p->p_frame == 0)
         return; /* No frame to deallocate */
 
-    clear_frame(p->p_frame);  /* Free the frame */
+    if (frame_refs[p->p_frame] != 0)
+        frame_refs[p->p_frame]--;             /* Still shared: drop this reference only */
+    else
+        free_frames(p->p_frame * 0x1000, 0);  /* Give the frame back to the buddy allocator */
     p->p_frame = 0;           /* Reset the frame address */
+    p->p_present = 0;         /* The page no longer maps anything */
+    p->p_cow = 0;
+}
+
+/**
+ * @brief Reads the processor feature flags.
+ *
+ * @return EDX of CPUID leaf 1 (CPUID_EDX_*).
+ */
+static uint32_t cpu_features(void) {
+    uint32_t eax, ebx, ecx, edx;
+
+    asm volatile("cpuid" : "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx) : "a"(1));
+    return (edx);
+}
+
+/**
+ * @brief Sets bits in CR4.
+ *
+ * @param bits The CR4_* bits to set.
+ */
+static void cr4_set(uint32_t bits) {
+    uint32_t cr4;
+
+    asm volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= bits;
+    asm volatile("mov %0, %%cr4" :: "r"(cr4));
+}
+
+/**
+ * @brief Flushes the whole TLB, global entries included.
+ */
+static void tlb_flush_all(void) {
+    uint32_t cr3, cr4;
+
+    if (pge_enabled) {
+        /* Turning CR4.PGE off and on again drops every entry */
+        asm volatile("mov %%cr4, %0" : "=r"(cr4));
+        asm volatile("mov %0, %%cr4" :: "r"(cr4 & ~CR4_PGE) : "memory");
+        asm volatile("mov %0, %%cr4" :: "r"(cr4) : "memory");
+    } else {
+        asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) :: "memory");
+    }
+}
+
+/**
+ * @brief Tells whether the TLB may hold a page of a directory.
+ *
+ * Only present pages are cached, and only those of the loaded directory or
+ * global ones.
+ *
+ * @param dir The page directory holding the page.
+ * @param p The page.
+ * @return 1 if the page must be flushed once it changes.
+ */
+static int tlb_cached(struct vm_page_directory *dir, struct vm_page *p) {
+    return (p->p_present && (dir == current_directory || p->p_global));
+}
+
+/**
+ * @brief Maps a frame at VM_KMAP_WINDOW, replacing whatever was mapped there.
+ *
+ * @param frame_addr The physical address of the frame.
+ * @return The virtual address of the window.
+ */
+static void *kmap(uint32_t frame_addr) {
+    set_page(kmap_page, frame_addr, VM_WRITE);
+    invlpg(VM_KMAP_WINDOW);
+    return ((void *)VM_KMAP_WINDOW);
+}
+
+/**
+ * @brief Returns the page table held by a page directory slot.
+ *
+ * The tables of the current directory, and any table the current directory
+ * shares, are in the recursive window. The tables of any other directory
+ * are in the foreign window, which is pointed at that directory first. The
+ * pointer is only valid until another directory's table is looked up.
+ *
+ * @param dir The page directory.
+ * @param table_idx The page directory slot; it must hold a page table.
+ * @return The page table.
+ */
+static struct vm_page_table *table_of(struct vm_page_directory *dir, uint32_t table_idx) {
+    uint32_t cr3;
+
+    if (!paging_enabled)
+        return ((struct vm_page_table *)(dir->pd_tblphys[table_idx] & PDE_FRAME));
+
+    if (dir == current_directory || dir->pd_tblphys[table_idx] == current_directory->pd_tblphys[table_idx])
+        return ((struct vm_page_table *)(VM_PAGE_TABLES + table_idx * 0x1000));
+
+    if (dir != foreign_directory) {
+        current_directory->pd_tblphys[PDE_FOREIGN] = dir->pd_tblphys[PDE_RECURSIVE];
+        foreign_directory = dir;
+
+        /* The window, and the CPU's cached directory entries, still describe the previous directory */
+        asm volatile("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) :: "memory");
+    }
+
+    return ((struct vm_page_table *)(VM_FOREIGN_TABLES + table_idx * 0x1000));
+}
+
+/**
+ * @brief Sets a page directory entry, and drops the stale view of it from the windows.
+ *
+ * @param dir The page directory.
+ * @param table_idx The page directory slot.
+ * @param pde The new entry.
+ */
+static void set_pde(struct vm_page_directory *dir, uint32_t table_idx, uint32_t pde) {
+    dir->pd_tblphys[table_idx] = pde;
+
+    if (paging_enabled && dir == current_directory)
+        invlpg(VM_PAGE_TABLES + table_idx * 0x1000);
+    else if (paging_enabled && dir == foreign_directory)
+        invlpg(VM_FOREIGN_TABLES + table_idx * 0x1000);
+}
+
+/**
+ * @brief Allocates a zeroed frame for a page table.
+ *
+ * @return The physical address of the frame.
+ */
+static uint32_t alloc_table_frame(void) {
+    uint32_t phys;
+
+    if (paging_enabled)
+        phys = alloc_frame_zeroed();
+    else
+        kmalloc0_ap(sizeof(struct vm_page_table), &phys);
+    page_tables++;
+
+    return (phys);
+}
+
+/**
+ * @brief Returns a page table that no directory points at yet, to fill it in.
+ *
+ * After paging is enabled this is the kmap window, so interrupts must stay
+ * disabled until the table is filled in.
+ *
+ * @param phys The physical address of the table.
+ * @return The table.
+ */
+static struct vm_page_table *table_frame(uint32_t phys) {
+    if (paging_enabled)
+        return (kmap(phys));
+    return ((struct vm_page_table *)phys);  /* Identity mapped */
+}
+
+/**
+ * @brief Gives a page directory slot a new, empty page table.
+ *
+ * @param dir The page directory.
+ * @param table_idx The page directory slot.
+ * @return The page table, as it is reached through the directory.
+ */
+static struct vm_page_table *create_table(struct vm_page_directory *dir, uint32_t table_idx) {
+    set_pde(dir, table_idx, alloc_table_frame() | 0x7);  /* PRESENT, RW, US */
+
+    return (table_of(dir, table_idx));
+}
+
+/**
+ * @brief Maps a 4MB chunk of virtual memory onto 4MB of physical memory with a single PDE.
+ *
+ * @param dir The page directory.
+ * @param table_idx The page directory slot (virtual address / 4MB).
+ * @param phys The physical address (4MB aligned).
+ * @param flags VM_WRITE, VM_USER and VM_GLOBAL (they match the PDE bits).
+ */
+static void map_large_page(struct vm_page_directory *dir, uint32_t table_idx, uint32_t phys,
+                           uint32_t flags) {
+    if (!pge_enabled)
+        flags &= ~VM_GLOBAL;
+    set_pde(dir, table_idx, phys | PDE_PRESENT | PDE_LARGE | (flags & (PDE_RW | PDE_USER | PDE_GLOBAL)));
+    large_pages++;
+}
+
+/**
+ * @brief Replaces a 4MB mapping with a page table mapping the same frames.
+ *
+ * @param dir The page directory.
+ * @param table_idx The page directory slot holding the 4MB mapping.
+ */
+static void split_large_page(struct vm_page_directory *dir, uint32_t table_idx) {
+    uint32_t pde = dir->pd_tblphys[table_idx];
+    uint32_t frame = (pde & PDE_LARGE_FRAME) / 0x1000;
+    struct vm_page_table *table;
+    uint32_t phys, flags, i;
+
+    /* Fill the table before the directory points at it: the 4MB page may hold this very code */
+    phys = alloc_table_frame();
+    flags = irq_save();
+    table = table_frame(phys);
+    for (i = 0; i < 1024; i++)
+        set_page(&table->pt_pages[i], (frame + i) * 0x1000, pde & (VM_WRITE | VM_USER | VM_GLOBAL));
+    irq_restore(flags);
+
+    set_pde(dir, table_idx, phys | 0x7);  /* PRESENT, RW, US */
+    invlpg(table_idx << 22);
+
+    large_pages--;
+    large_splits++;
+}
+
+/**
+ * @brief Translates a virtual address to a physical address.
+ *
+ * Unlike get_page(), this never splits a 4MB mapping.
+ *
+ * @param address The virtual address.
+ * @param dir The page directory to look in.
+ * @return The physical address, or -1 if the address is not mapped.
+ */
+uint32_t virt_to_phys(uint32_t address, struct vm_page_directory *dir) {
+    uint32_t table_idx = address >> 22;
+    uint32_t pde = dir->pd_tblphys[table_idx];
+    struct vm_page *page;
+
+    if (!(pde & PDE_PRESENT))
+        return (-1);
+
+    if (pde & PDE_LARGE)
+        return ((pde & PDE_LARGE_FRAME) + (address & 0x3FFFFF));
+
+    page = &table_of(dir, table_idx)->pt_pages[(address / 0x1000) % 1024];
+    if (!page->p_present)
+        return (-1);
+
+    return (page->p_frame * 0x1000 + (address & 0xFFF));
+}
+
+/**
+ * @brief Prints how physical memory is mapped by large pages and page tables,
+ * and how well the pre-zeroed pool keeps up.
+ */
+void paging_dump(void) {
+    printk("paging: PSE %s, %u 4MB pages (%u fewer TLB entries), %u split\n",
+           pse_enabled ? "on" : "off", large_pages, large_pages * 1023, large_splits);
+    printk("paging: %u page tables (%u KB)\n", page_tables, page_tables * 4);
+    printk("paging: %u pre-zeroed frames, %u zeroed allocations from the pool, %u zeroed on the spot\n",
+           zero_pool_count, zero_pool_hits, zero_pool_misses);
+}
+
+/*
+ * Range operations:
+ * vm_map_range() and friends split a range at page table boundaries and
+ * handle each piece with a single directory lookup, walking the table's
+ * entries directly. A piece is at most RANGE_CHUNK() pages long.
+ */
+#define RANGE_CHUNK(vaddr, npages) \
+    (((npages) < 1024 - (((vaddr) >> 12) & 1023)) ? (npages) : 1024 - (((vaddr) >> 12) & 1023))
+
+/**
+ * @brief Backs a virtual range with newly allocated frames.
+ *
+ * Frames are taken from the buddy allocator in the largest blocks that fit
+ * the rest of each page table, so a range costs a handful of allocations
+ * instead of one per page. Pages that already have a frame are left alone.
+ * Whole page tables that do not exist yet are mapped as 4MB pages when PSE
+ * is available. Nothing was mapped before, so nothing is flushed.
+ *
+ * @param dir The page directory to map the range in.
+ * @param vaddr The first virtual address (page aligned).
+ * @param npages The number of pages to map.
+ * @param flags VM_WRITE, VM_USER and VM_GLOBAL.
+ */
+void vm_map_range(struct vm_page_directory *dir, uint32_t vaddr, uint32_t npages, uint32_t flags) {
+    uint32_t n, order, addr, i;
+    struct vm_page *p;
+
+    while (npages > 0) {
+        n = RANGE_CHUNK(vaddr, npages);
+
+        /* A whole 4MB chunk gets a single 4MB mapping, if a 4MB block is free */
+        if (pse_enabled && n == 1024 && dir->pd_tblphys[vaddr >> 22] == 0 &&
+            (addr = alloc_frames(FRAME_MAX_ORDER)) != -1) {
+            map_large_page(dir, vaddr >> 22, addr, flags);
+            vaddr += 0x400000;
+            npages -= 1024;
+            continue;
+        }
+
+        p = get_page(vaddr, 1, dir);
+        vaddr += n * 0x1000;
+        npages -= n;
+
+        while (n > 0) {
+            /* Largest block that does not run past the end of the table */
+            order = 31 - __builtin_clz(n);
+            if (order > FRAME_MAX_ORDER)
+                order = FRAME_MAX_ORDER;
+            while ((addr = alloc_frames(order)) == -1) {
+                if (order == 0)
+                    panic("No free frame.");
+                order--;
+            }
+
+            for (i = 0; i < (1 << order); i++, p++, addr += 0x1000) {
+                if (p->p_frame != 0)
+                    free_frames(addr, 0);   /* Already backed: give this frame back */
+                else
+                    set_page(p, addr, flags);
+            }
+            n -= (1 << order);
+        }
+    }
+}
+
+/**
+ * @brief Maps virtual pages onto physically contiguous frames owned by the caller.
+ *
+ * Pages that were already mapped are flushed from the TLB: one by one for
+ * up to VM_TLB_FLUSH_MAX pages, with a single full flush for more.
+ *
+ * @param dir The page directory to map the pages in.
+ * @param vaddr The first virtual address (page aligned).
+ * @param paddr The physical address of the first frame (page aligned).
+ * @param npages The number of pages to map.
+ * @param flags VM_WRITE, VM_USER and VM_GLOBAL.
+ */
+void vm_map(struct vm_page_directory *dir, uint32_t vaddr, uint32_t paddr, uint32_t npages,
+            uint32_t flags) {
+    int batch = (npages > VM_TLB_FLUSH_MAX);
+    int stale = 0, cached;
+    uint32_t n;
+    struct vm_page *p;
+
+    while (npages > 0) {
+        n = RANGE_CHUNK(vaddr, npages);
+        npages -= n;
+
+        for (p = get_page(vaddr, 1, dir); n > 0; n--, p++, vaddr += 0x1000, paddr += 0x1000) {
+            cached = tlb_cached(dir, p);
+            set_page(p, paddr, flags);
+            if (cached && !batch)
+                invlpg(vaddr);
+            stale |= cached;
+        }
+    }
+
+    if (stale && batch)
+        tlb_flush_all();
+}
+
+/**
+ * @brief Unmaps a virtual range and gives its frames back to the allocator.
+ *
+ * 4MB pages that the range covers whole are freed as one block; ones it
+ * covers in part are split first. The TLB is flushed as in vm_map().
+ *
+ * @param dir The page directory to unmap the range from.
+ * @param vaddr The first virtual address (page aligned).
+ * @param npages The number of pages to unmap.
+ */
+void vm_unmap_range(struct vm_page_directory *dir, uint32_t vaddr, uint32_t npages) {
+    int batch = (npages > VM_TLB_FLUSH_MAX);
+    int stale = 0, cached;
+    uint32_t n, pde;
+    struct vm_page *p;
+
+    while (npages > 0) {
+        n = RANGE_CHUNK(vaddr, npages);
+        npages -= n;
+        pde = dir->pd_tblphys[vaddr >> 22];
+
+        if (!(pde & PDE_PRESENT)) {
+            vaddr += n * 0x1000;
+            continue;
+        }
+
+        if ((pde & PDE_LARGE) && n == 1024) {
+            free_frames(pde & PDE_LARGE_FRAME, FRAME_MAX_ORDER);
+            set_pde(dir, vaddr >> 22, 0);
+            large_pages--;
+            if (!batch)
+                invlpg(vaddr);      /* One entry covers the whole 4MB page */
+            stale = 1;
+            vaddr += 0x400000;
+            continue;
+        }
+
+        for (p = get_page(vaddr, 0, dir); n > 0; n--, p++, vaddr += 0x1000) {
+            if (!p->p_present)
+                continue;
+
+            cached = tlb_cached(dir, p);
+            free_frame(p);
+            p->p_global = 0;
+            if (cached && !batch)
+                invlpg(vaddr);
+            stale |= cached;
+        }
+    }
+
+    if (stale && batch)
+        tlb_flush_all();
+}
+
+/**
+ * @brief Changes the protection of mapped virtual pages.
+ *
+ * Only the pages whose flags actually change are flushed, as in vm_map().
+ *
+ * @param dir The page directory holding the pages.
+ * @param vaddr The first virtual address (page aligned).
+ * @param npages The number of pages to change.
+ * @param flags The new VM_WRITE, VM_USER and VM_GLOBAL flags.
+ */
+void vm_protect(struct vm_page_directory *dir, uint32_t vaddr, uint32_t npages, uint32_t flags) {
+    int batch = (npages > VM_TLB_FLUSH_MAX);
+    int stale = 0, cached;
+    uint32_t n;
+    struct vm_page *p, old;
+
+    while (npages > 0) {
+        n = RANGE_CHUNK(vaddr, npages);
+        npages -= n;
+
+        p = get_page(vaddr, 0, dir);
+        if (p == NULL) {
+            vaddr += n * 0x1000;
+            continue;
+        }
+
+        for (; n > 0; n--, p++, vaddr += 0x1000) {
+            if (!p->p_present)
+                continue;
+
+            old = *p;
+            cached = tlb_cached(dir, p);
+            set_page(p, old.p_frame * 0x1000, flags);
+            if (p->p_rw == old.p_rw && p->p_user == old.p_user && p->p_global == old.p_global)
+                continue;
+
+            if (cached && !batch)
+                invlpg(vaddr);
+            stale |= cached;
+        }
+    }
+
+    if (stale && batch)
+        tlb_flush_all();
+}
+
+/**
+ * @brief Allocates a zeroed frame, from the pre-zeroed pool when possible.
+ *
+ * @return The physical address of the frame.
+ */
+uint32_t alloc_frame_zeroed(void) {
+    uint32_t flags = irq_save();
+    uint32_t frame;
+
+    if (zero_pool_count != 0) {
+        frame = zero_pool[--zero_pool_count];
+        zero_pool_hits++;
+    } else {
+        frame = alloc_frames(0);
+        if (frame == -1)
+            panic("No free frame.");
+        bzero(kmap(frame), 0x1000);
+        zero_pool_misses++;
+    }
+
+    irq_restore(flags);
+
+    return (frame);
+}
+
+/**
+ * @brief Zeroes free frames into the pre-zeroed pool.
+ *
+ * Interrupts are only disabled for one frame at a time.
+ *
+ * @param max The largest number of frames to add.
+ * @return The number of frames added (0 when the pool is full or memory is out).
+ */
+uint32_t zero_pool_refill(uint32_t max) {
+    uint32_t added, frame, flags;
+
+    for (added = 0; added < max; added++) {
+        flags = irq_save();
+        if (zero_pool_count == VM_ZERO_POOL_SIZE || (frame = alloc_frames(0)) == -1) {
+            irq_restore(flags);
+            break;
+        }
+        bzero(kmap(frame), 0x1000);
+        zero_pool[zero_pool_count++] = frame;
+        irq_restore(flags);
+    }
+
+    return (added);
+}
+
+/**
+ * @brief Keeps the pre-zeroed pool full.
+ *
+ * The frames are zeroed a few at a time; once the pool is full the thread
+ * sleeps for a tick instead of spinning, so an idle CPU can halt.
+ *
+ * @param arg Unused.
+ * @return Never returns.
+ */
+int zero_pool_thread(void *arg) {
+    for (;;) {
+        if (zero_pool_refill(8) == 0)
+            thread_sleep(1);
+    }
+
+    return (0);
+}
+
+/**
+ * @brief Copies a page table for clone_directory(), sharing its frames copy-on-write.
+ *
+ * Writeable pages become read-only in both tables and are marked p_cow.
+ *
+ * @param dir The page directory holding the table to copy.
+ * @param table_idx The page directory slot of the table.
+ * @return The physical address of the copy.
+ */
+static uint32_t clone_table(struct vm_page_directory *dir, uint32_t table_idx) {
+    struct vm_page_table *table, *src;
+    uint32_t phys, flags, i;
+
+    phys = alloc_table_frame();
+    flags = irq_save();
+    src = table_of(dir, table_idx);
+    table = table_frame(phys);
+
+    for (i = 0; i < 1024; i++) {
+        struct vm_page *p = &src->pt_pages[i];
+
+        if (!p->p_present)
+            continue;
+
+        kassert("frame reference count fits", frame_refs[p->p_frame] != 0xFFFF);
+        frame_refs[p->p_frame]++;
+        if (p->p_rw) {
+            p->p_rw = 0;
+            p->p_cow = 1;
+        }
+        table->pt_pages[i] = *p;
+    }
+    irq_restore(flags);
+
+    return (phys);
+}
+
+/**
+ * @brief Creates a copy-on-write copy of an address space.
+ *
+ * Slots that hold the same entry as the kernel directory (page tables and
+ * 4MB pages of the kernel) are shared as they are. Every other page table is
+ * copied, and its pages are shared copy-on-write. Kernel heap page tables
+ * created after the copy is made are copied in by page_fault_handler().
+ *
+ * @param src The page directory to copy.
+ * @return The new page directory.
+ */
+struct vm_page_directory *clone_directory(struct vm_page_directory *src) {
+    struct vm_page_directory *dir;
+    uint32_t phys, i;
+
+    dir = kmalloc0_ap(sizeof(struct vm_page_directory), &phys);
+    dir->pd_tblphys[PDE_RECURSIVE] = phys | PDE_PRESENT | PDE_RW;
+
+    /* The two window slots are private to each directory */
+    for (i = 0; i < PDE_FOREIGN; i++) {
+        if (src->pd_tblphys[i] == 0)
+            continue;
+
+        /* Kernel page tables are shared by reference */
+        if (src->pd_tblphys[i] == kernel_directory->pd_tblphys[i]) {
+            dir->pd_tblphys[i] = src->pd_tblphys[i];
+            continue;
+        }
+
+        /* A private 4MB page is shared page by page */
+        if (src->pd_tblphys[i] & PDE_LARGE)
+            split_large_page(src, i);
+
+        dir->pd_tblphys[i] = clone_table(src, i) | 0x7;  /* PRESENT, RW, US */
+    }
+
+    /* The source lost write access to its private pages */
+    if (src == current_directory)
+        tlb_flush_all();
+
+    return (dir);
+}
+
+/**
+ * @brief Brings a kernel heap page table into the current address space.
+ *
+ * A copy made by clone_directory() only has the kernel page tables that
+ * existed when it was made. The kernel heap creates the tables it grows
+ * into in kernel_directory alone, so the first fault on one of them from a
+ * copy takes the kernel's entry over.
+ *
+ * @param address The faulting virtual address.
+ * @return 1 if the entry was missing and has been copied, 0 otherwise.
+ */
+static int kernel_pde_fault(uint32_t address) {
+    extern struct vm_heap *kernel_heap;
+    uint32_t table_idx = address >> 22;
+
+    if (current_directory == kernel_directory || kernel_heap == NULL)
+        return (0);
+    if (address < kernel_heap->h_addr_start || address >= kernel_heap->h_addr_max)
+        return (0);
+    if ((current_directory->pd_tblphys[table_idx] & PDE_PRESENT) ||
+        !(kernel_directory->pd_tblphys[table_idx] & PDE_PRESENT))
+        return (0);
+
+    set_pde(current_directory, table_idx, kernel_directory->pd_tblphys[table_idx]);
+
+    return (1);
+}
+
+/**
+ * @brief Resolves a write fault on a copy-on-write page of the current address space.
+ *
+ * The last user of a frame takes it over; anybody else gets a copy.
+ *
+ * @param address The faulting virtual address.
+ * @return 1 if the fault was a copy-on-write fault and is resolved, 0 otherwise.
+ */
+static int cow_fault(uint32_t address) {
+    struct vm_page *p = get_page(address, 0, current_directory);
+    uint32_t copy;
+
+    if (p == NULL || !p->p_present || !p->p_cow)
+        return (0);
+
+    if (frame_refs[p->p_frame] != 0) {
+        copy = alloc_frames(0);
+        if (copy == -1)
+            panic("No free frame.");
+
+        memcpy(kmap(copy), (void *)(address & 0xFFFFF000), 0x1000);
+        frame_refs[p->p_frame]--;
+        p->p_frame = copy / 0x1000;
+    }
+
+    p->p_rw = 1;
+    p->p_cow = 0;
+    invlpg(address);
+
+    return (1);
 }
 
 /**
  * @brief Initializes the paging system, setting up the kernel page directory, heap, and memory mapping.
+ *
+ * @param mbi The multiboot information passed by the boot loader, used to size physical memory.
  */
-void init_paging(void) {
-    int i;
-    uint32_t mem_end_page;
+void init_paging(struct multiboot_info *mbi) {
+    uint32_t i, j, n, features;
     extern struct vm_heap *kernel_heap;
 
-    /* Size of physical memory (16MB for now) */
-    mem_end_page = 0x1000000;
+    /* Size physical memory from the boot loader's memory map */
+    nframes = read_memory_map(mbi);
+    init_frames();
+    reserve_unusable_frames();
 
-    nframes = mem_end_page / 0x1000;
-    frames = kmalloc0(INDEX_FROM_BIT(nframes));
+    /* Use 4MB pages and global pages where possible */
+    features = cpu_features();
+    pse_enabled = (features & CPUID_EDX_PSE) != 0;
+    pge_enabled = (features & CPUID_EDX_PGE) != 0;
+    if (pse_enabled)
+        cr4_set(CR4_PSE);
 
     /* Create the kernel page directory */
     kernel_directory = kmalloc0_a(sizeof(struct vm_page_directory));
+    kernel_directory->pd_tblphys[PDE_RECURSIVE] = (uint32_t)kernel_directory | PDE_PRESENT | PDE_RW;  /* Identity mapped */
 
-    /* Map some pages in the kernel heap area */
-    for (i = VM_KERN_HEAP_START; i < VM_KERN_HEAP_START + VM_KERN_HEAP_INITIAL_SIZE; i += 0x1000)
+    /* The table of the kmap window belongs to the kernel, so every address space shares it */
+    kmap_page = get_page(VM_KMAP_WINDOW, 1, kernel_directory);
+
+    /* Create the page tables of the initial kernel heap, one per 4MB */
+    for (i = VM_KERN_HEAP_START; i < VM_KERN_HEAP_START + VM_KERN_HEAP_INITIAL_SIZE; i += 0x400000)
         get_page(i, 1, kernel_directory);
 
     /* Allocate the kernel heap before identity mapping */
@@ -146,13 +1181,35 @@ void init_paging(void) {
     /* Identity map physical memory from 0x0 to the end of used memory */
     i = 0;
     while (i < placement_address) {
-        alloc_frame(get_page(i, 1, kernel_directory), 0, 0);
-        i += 0x1000;
+        if (pse_enabled && (i & 0x3FFFFF) == 0 && i + 0x400000 <= placement_address &&
+            kernel_directory->pd_tblphys[i >> 22] == 0) {
+            /*
+             * One 4MB page, and no page table, for each chunk that is used whole. A
+             * partly used chunk is mapped page by page below, so that its free frames
+             * are not reachable through the identity map once the allocator hands them out.
+             */
+            map_large_page(kernel_directory, i >> 22, i, VM_WRITE | VM_GLOBAL);
+            for (j = i; j < i + 0x400000; j += 0x1000)
+                reserve_frame(j / 0x1000);
+            i += 0x400000;
+        } else {
+            /*
+             * The rest of the 4MB chunk, up to the end of used memory, in one go. The
+             * frames may already be out of the allocator if they are not usable RAM
+             * (such as the VGA memory). A page table created here moves
+             * placement_address, and is mapped by the next round.
+             */
+            n = RANGE_CHUNK(i, (placement_address - i + 0xFFF) / 0x1000);
+            for (j = i; j < i + n * 0x1000; j += 0x1000)
+                reserve_frame(j / 0x1000);
+            vm_map(kernel_directory, i, i, n, VM_WRITE | VM_GLOBAL);
+            i += n * 0x1000;
+        }
     }
 
-    /* Allocate the pages we mapped earlier */
-    for (i = VM_KERN_HEAP_START; i < VM_KERN_HEAP_START + VM_KERN_HEAP_INITIAL_SIZE; i += 0x1000)
-        alloc_frame(get_page(i, 0, kernel_directory), 0, 0);
+    /* Back the initial kernel heap, now that the frames in use are out of the allocator */
+    vm_map_range(kernel_directory, VM_KERN_HEAP_START, VM_KERN_HEAP_INITIAL_SIZE / 0x1000,
+                 VM_WRITE | VM_USER | VM_GLOBAL);
 
     /* Register the page fault handler */
     register_interrupt_handler(14, page_fault_handler);
@@ -160,9 +1217,16 @@ void init_paging(void) {
     /* Enable paging */
     switch_page_directory(kernel_directory);
 
+    /* Kernel mappings are global from now on; CR4.PGE may only be set once paging is on */
+    if (pge_enabled)
+        cr4_set(CR4_PGE);
+
     /* Set up the kernel heap for memory allocation */
     kernel_heap = init_heap(heap, VM_KERN_HEAP_START, VM_KERN_HEAP_START +
                             VM_KERN_HEAP_INITIAL_SIZE, 0xCFFFF000, 0, 0);
+
+    /* Pages the kernel heap grows into are backed on first touch */
+    kernel_heap->h_demand = 1;
 }
 
 /**
@@ -173,11 +1237,20 @@ void init_paging(void) {
 void switch_page_directory(struct vm_page_directory *dir) {
     uint32_t cr0;
 
+    /* Loading CR3 flushes every non-global TLB entry, so don't reload the same directory */
+    if (dir == current_directory)
+        return;
+
     current_directory = dir;
-    asm volatile("mov %0, %%cr3":: "r"(&dir->pd_tblphys));
+    foreign_directory = NULL;
+    asm volatile("mov %0, %%cr3":: "r"(dir->pd_tblphys[PDE_RECURSIVE] & PDE_FRAME));
     asm volatile("mov %%cr0, %0": "=r"(cr0));
-    cr0 |= 0x80000000; /* Enable paging */
-    asm volatile("mov %0, %%cr0":: "r"(cr0));
+    if (!(cr0 & CR0_PG)) {
+        /* Enable paging, the first time only; WP makes copy-on-write pages read-only to the kernel */
+        cr0 |= CR0_PG | CR0_WP;
+        asm volatile("mov %0, %%cr0":: "r"(cr0));
+        paging_enabled = 1;
+    }
 }
 
 /**
@@ -192,31 +1265,50 @@ struct vm_page *get_page(uint32_t address, int create, struct vm_page_directory
     address /= 0x1000;
     uint32_t table_idx = address / 1024;
 
+    /* A 4MB mapping has no page entries: split it first */
+    if (dir->pd_tblphys[table_idx] & PDE_LARGE)
+        split_large_page(dir, table_idx);
+
     /* If page table already exists */
-    if (dir->pd_tables[table_idx] != NULL)
-        return (&dir->pd_tables[table_idx]->pt_pages[address % 1024]);
+    if (dir->pd_tblphys[table_idx] & PDE_PRESENT)
+        return (&table_of(dir, table_idx)->pt_pages[address % 1024]);
     else if (create) {
-        uint32_t tmp;
-        dir->pd_tables[table_idx] = kmalloc0_ap(sizeof(struct vm_page_table), &tmp);
-        dir->pd_tblphys[table_idx] = tmp | 0x7;  /* PRESENT, RW, US */
-        return (&dir->pd_tables[table_idx]->pt_pages[address % 1024]);
+        return (&create_table(dir, table_idx)->pt_pages[address % 1024]);
     } else {
         return (0);
     }
 }
 
 /**
- * @brief Handles page faults by printing detailed information and halting execution.
+ * @brief Handles page faults. Not-present faults in the kernel heap are demand
+ * paging and write faults on copy-on-write pages make a private copy;
+ * anything else prints detailed information and halts execution.
  *
  * @param regs The register state at the time of the page fault.
  */
 void page_fault_handler(registers_t *regs) {
     uint32_t faulting_address;
     int present, rw, us, reserved, id;
+    extern struct vm_heap *kernel_heap;
 
     /* Get the faulting address from CR2 register */
     asm volatile("mov %%cr2, %0" : "=r" (faulting_address));
 
+    /*
+     * A not-present fault in the reserved part of the kernel heap is demand paging,
+     * once a copied address space has the kernel's page table for it
+     */
+    if (!(regs->err_code & 0x1)) {
+        int copied = kernel_pde_fault(faulting_address);
+
+        if (heap_fault(faulting_address, kernel_heap) || copied)
+            return;
+    }
+
+    /* A write to a present page may be a write to a copy-on-write page */
+    if ((regs->err_code & 0x3) == 0x3 && cow_fault(faulting_address))
+        return;
+
     /* Get error code details */
     present = !(regs->err_code & 0x1);  /* Page not present */
     rw = regs->err_code & 0x2;          /* Write operation? */
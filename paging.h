@@ -4,14 +4,71 @@
 #include "system.h"
 #include "descriptor_tables.h"
 
+/* Largest block order of the physical frame allocator (2^10 frames = 4MB) */
+#define FRAME_MAX_ORDER 10
+
+/* Page directory entry bits */
+#define PDE_PRESENT     0x001       /* The entry maps something */
+#define PDE_RW          0x002       /* Writeable */
+#define PDE_USER        0x004       /* Accessible from user mode */
+#define PDE_LARGE       0x080       /* Maps a 4MB page directly (needs CR4.PSE) */
+#define PDE_GLOBAL      0x100       /* 4MB page survives CR3 reloads (needs CR4.PGE) */
+#define PDE_FRAME       0xFFFFF000  /* Physical address of a page table */
+#define PDE_LARGE_FRAME 0xFFC00000  /* Physical address of a 4MB page */
+
+#define CPUID_EDX_PSE   (1 << 3)    /* CPUID leaf 1: 4MB pages are supported */
+#define CPUID_EDX_PGE   (1 << 13)   /* CPUID leaf 1: global pages are supported */
+#define CR4_PSE         (1 << 4)    /* CR4: enable 4MB pages */
+#define CR4_PGE         (1 << 7)    /* CR4: enable global pages */
+#define CR0_WP          (1 << 16)   /* CR0: read-only pages are read-only to the kernel too */
+#define CR0_PG          (1 << 31)   /* CR0: enable paging */
+
+/*
+ * Recursive mapping:
+ * The last directory entry of every address space points at the directory
+ * itself, so the page tables of the loaded directory appear as the 1024
+ * pages at VM_PAGE_TABLES, and the directory as the last of them. The
+ * entry before it is pointed at another directory on demand, to reach that
+ * directory's page tables at VM_FOREIGN_TABLES.
+ */
+#define PDE_RECURSIVE       1023
+#define PDE_FOREIGN         1022
+#define VM_PAGE_TABLES      0xFFC00000
+#define VM_FOREIGN_TABLES   0xFF800000
+
+/*
+ * Virtual page through which the kernel reaches a frame that it has no
+ * mapping for, such as the copy made on a copy-on-write fault.
+ */
+#define VM_KMAP_WINDOW  0xFF7FF000
+
+/* Number of pre-zeroed frames kept for alloc_frame_zeroed() */
+#define VM_ZERO_POOL_SIZE 64
+
+/* Flags of the vm_map() family. The values match the page entry bits. */
+#define VM_WRITE        0x002       /* Writeable */
+#define VM_USER         0x004       /* Accessible from user mode */
+#define VM_GLOBAL       0x100       /* Shared by every address space: kept in the TLB across switches */
+
+/*
+ * Above this many pages, a range operation flushes the whole TLB once
+ * instead of invalidating its pages one by one.
+ */
+#define VM_TLB_FLUSH_MAX 32
+
 /* Structure representing a single virtual memory page. */
 struct vm_page {
     uint32_t p_present  : 1;   /* Page is present in memory (1) or not (0) */
     uint32_t p_rw       : 1;   /* Read-Write permission (1 for read-write, 0 for read-only) */
     uint32_t p_user     : 1;   /* User-mode (1) or Supervisor-mode (0) access */
+    uint32_t p_pwt      : 1;   /* Write-through caching (1) or write-back (0) */
+    uint32_t p_pcd      : 1;   /* Caching disabled (1) or enabled (0) */
     uint32_t p_accessed : 1;   /* Has the page been accessed since the last refresh? (1 for yes, 0 for no) */
     uint32_t p_dirty    : 1;   /* Has the page been written to since the last refresh? (1 for yes, 0 for no) */
-    uint32_t p_unused   : 7;   /* Unused and reserved bits (not used by the operating system) */
+    uint32_t p_pat      : 1;   /* Page attribute table index bit */
+    uint32_t p_global   : 1;   /* Not flushed from the TLB when CR3 is reloaded (needs CR4.PGE) */
+    uint32_t p_cow      : 1;   /* Read-only because its frame is shared: copy it on the first write */
+    uint32_t p_avail    : 2;   /* Available for use by the operating system */
     uint32_t p_frame    : 20;  /* Frame address (shifted right by 12 bits to address page frames) */
 };
 
@@ -20,43 +77,55 @@ struct vm_page_table {
     struct vm_page pt_pages[1024]; /* Array of 1024 pages, each represented by struct vm_page */
 };
 
-/* Structure representing a page directory, which holds 1024 page tables */
+/*
+ * Structure representing a page directory, which holds 1024 page tables.
+ * It is exactly the page the CPU walks: the tables themselves are reached
+ * through the recursive mapping.
+ */
 struct vm_page_directory {
     /*
-     * Array of pointers to page tables (each containing 1024 pages).
-     * The page directory itself contains up to 1024 entries.
-     */
-    struct vm_page_table *pd_tables[1024];
-    
-    /*
-     * Array of physical addresses of page tables.
-     * These are used when loading the page directory into the CR3 register.
+     * Array of physical addresses of page tables (or 4MB pages), with their
+     * PDE_* bits. pd_tblphys[PDE_RECURSIVE] holds the physical address of
+     * the directory itself, which is what gets loaded into CR3.
      */
     uint32_t pd_tblphys[1024];
-
-    /*
-     * The physical address of pd_tblphys, which is necessary when the
-     * kernel heap is allocated at a different location in memory.
-     */
-    uint32_t pd_tblphys_addr;
 };
 
+struct multiboot_info;
+
 /*
  * Initializes paging by setting up page directories and enabling paging.
+ * Physical memory is sized from the multiboot memory map.
+ *
+ * @param mbi: The multiboot information passed by the boot loader (may be NULL).
  */
-void init_paging(void);
+void init_paging(struct multiboot_info *mbi);
 
 /*
  * Switches the current page directory to the specified one.
- * Loads the page directory into the CR3 register.
+ * Loads the page directory into the CR3 register, unless it is already loaded.
  * 
  * @param pd: Pointer to the page directory to switch to.
  */
 void switch_page_directory(struct vm_page_directory *pd);
 
+/*
+ * Creates a copy of an address space. Page tables shared with the kernel
+ * directory are shared by the copy too (kernel heap tables created later
+ * on the first fault); every other page is shared copy-on-write, so no
+ * frame is copied until one side writes to it.
+ *
+ * @param src: Pointer to the page directory to copy.
+ * @return: Pointer to the new page directory.
+ */
+struct vm_page_directory *clone_directory(struct vm_page_directory *src);
+
 /*
  * Retrieves a pointer to the page corresponding to a given virtual address.
  * If the page table is not created and create == 1, it will create the page table.
+ * A 4MB page covering the address is split into a page table first.
+ * For a directory other than the current one, the pointer goes through the
+ * foreign window and is only valid until another directory is looked at.
  *
  * @param address: The virtual address to locate the page for.
  * @param create: Flag indicating whether to create a new page table if needed.
@@ -65,6 +134,23 @@ void switch_page_directory(struct vm_page_directory *pd);
  */
 struct vm_page *get_page(uint32_t address, int create, struct vm_page_directory *dir);
 
+/*
+ * Translates a virtual address to the physical address it is mapped to.
+ * Works for 4MB pages too, without splitting them.
+ *
+ * @param address: The virtual address.
+ * @param dir: Pointer to the page directory to look in.
+ * @return: The physical address, or -1 if the address is not mapped.
+ */
+uint32_t virt_to_phys(uint32_t address, struct vm_page_directory *dir);
+
+/*
+ * Prints how many 4MB pages are in use and how many TLB entries they save,
+ * how much memory page tables take, and how well the pool of pre-zeroed
+ * frames keeps up.
+ */
+void paging_dump(void);
+
 /*
  * Allocates a frame (physical memory) to a page and sets the relevant flags.
  *
@@ -75,7 +161,97 @@ struct vm_page *get_page(uint32_t address, int create, struct vm_page_directory
 void alloc_frame(struct vm_page *p, int is_kernel, int is_writeable);
 
 /*
- * Frees the frame (physical memory) associated with a page.
+ * Allocates a frame filled with zeroes. Frames come from the pool of
+ * pre-zeroed frames when it has one, and are zeroed on the spot otherwise.
+ *
+ * @return: The physical address of the frame.
+ */
+uint32_t alloc_frame_zeroed(void);
+
+/*
+ * Zeroes free frames into the pool used by alloc_frame_zeroed().
+ *
+ * @param max: The largest number of frames to add.
+ * @return: The number of frames added (0 when the pool is full).
+ */
+uint32_t zero_pool_refill(uint32_t max);
+
+/*
+ * Thread that keeps the pool of pre-zeroed frames full, and gives its turn
+ * away whenever it is.
+ *
+ * @param arg: Unused.
+ */
+int zero_pool_thread(void *arg);
+
+/*
+ * Backs a virtual range with newly allocated frames, taking frames from the
+ * buddy allocator in blocks and walking each page table once. Pages that
+ * already have a frame are left alone.
+ *
+ * @param dir: Pointer to the page directory to map the range in.
+ * @param vaddr: The first virtual address (page aligned).
+ * @param npages: The number of pages to map.
+ * @param flags: VM_WRITE, VM_USER and VM_GLOBAL.
+ */
+void vm_map_range(struct vm_page_directory *dir, uint32_t vaddr, uint32_t npages, uint32_t flags);
+
+/*
+ * Maps npages virtual pages onto physically contiguous frames, creating page
+ * tables as needed. The frames are not taken from the allocator: the caller
+ * owns them. Replaced mappings are flushed from the TLB.
+ *
+ * @param dir: Pointer to the page directory to map the pages in.
+ * @param vaddr: The first virtual address (page aligned).
+ * @param paddr: The physical address of the first frame (page aligned).
+ * @param npages: The number of pages to map.
+ * @param flags: VM_WRITE, VM_USER and VM_GLOBAL.
+ */
+void vm_map(struct vm_page_directory *dir, uint32_t vaddr, uint32_t paddr, uint32_t npages,
+            uint32_t flags);
+
+/*
+ * Unmaps npages virtual pages, gives their frames back to the allocator and
+ * flushes them from the TLB, walking each page table once. Pages that are
+ * not mapped are skipped.
+ *
+ * @param dir: Pointer to the page directory to unmap the pages from.
+ * @param vaddr: The first virtual address (page aligned).
+ * @param npages: The number of pages to unmap.
+ */
+void vm_unmap_range(struct vm_page_directory *dir, uint32_t vaddr, uint32_t npages);
+
+/*
+ * Changes the protection of npages mapped virtual pages and flushes the
+ * ones that changed from the TLB. Pages that are not mapped are skipped.
+ *
+ * @param dir: Pointer to the page directory holding the pages.
+ * @param vaddr: The first virtual address (page aligned).
+ * @param npages: The number of pages to change.
+ * @param flags: The new VM_WRITE, VM_USER and VM_GLOBAL flags.
+ */
+void vm_protect(struct vm_page_directory *dir, uint32_t vaddr, uint32_t npages, uint32_t flags);
+
+/*
+ * Allocates 2^order physically contiguous frames from the buddy allocator.
+ *
+ * @param order: The order of the allocation (0 to FRAME_MAX_ORDER).
+ * @return: The physical address of the first frame, or -1 if no block is large enough.
+ */
+uint32_t alloc_frames(uint32_t order);
+
+/*
+ * Returns 2^order physically contiguous frames to the buddy allocator.
+ *
+ * @param addr: The physical address returned by alloc_frames().
+ * @param order: The order the block was allocated with.
+ */
+void free_frames(uint32_t addr, uint32_t order);
+
+/*
+ * Frees the frame (physical memory) associated with a page. A frame that is
+ * still shared copy-on-write only loses a reference.
+ * The caller must flush the page from the TLB; vm_unmap_range() does both.
  *
  * @param p: Pointer to the vm_page structure representing the page.
  */
@@ -0,0 +1,296 @@
+#include "scheduler.h"
+
+/*
+ * Deadline class: earliest deadline first with constant bandwidth servers.
+ *
+ * Runnable threads are kept in dl_ready sorted by absolute deadline, so the
+ * next thread is always at the head. Threads that are done with their
+ * period, or used up their runtime, wait in dl_wait sorted by the start of
+ * their next period and are moved back by dl_clock(). Both lists are short:
+ * admission control keeps the number of deadline threads small.
+ *
+ * Budgets are charged a whole tick at a time, so a thread should ask for
+ * a tick more runtime than its work takes.
+ */
+
+static struct run_queue dl_ready;       // Runnable threads, by absolute deadline
+static struct run_queue dl_wait;        // Throttled threads, by start of their next period
+static uint32_t dl_total_bw;            // Sum of dl_bw over the threads of the class
+
+/**
+ * @brief Compares two points in time on the (wrapping) scheduler clock.
+ *
+ * @return Nonzero if a is before b.
+ */
+static int time_before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+/**
+ * @brief Inserts a thread in one of the lists of the class, keeping it sorted.
+ *
+ * dl_ready is sorted by absolute deadline and dl_wait by period start. The
+ * list is scanned from the back, where new periods usually end up.
+ *
+ * @param rq dl_ready or dl_wait.
+ * @param t The thread, which must not be in any queue.
+ */
+static void dl_insert(struct run_queue *rq, thread_t *t)
+{
+    thread_t *pos;
+    uint32_t key = (rq == &dl_ready) ? t->dl_abs_deadline : t->dl_release;
+
+    for (pos = rq->rq_tail; pos; pos = pos->rq_prev)
+        if (!time_before(key, (rq == &dl_ready) ? pos->dl_abs_deadline : pos->dl_release))
+            break;
+
+    // Insert after `pos`, or at the front if every thread comes after `t`
+    rq_insert(rq, t, pos ? pos->rq_next : rq->rq_head);
+}
+
+/**
+ * @brief Makes a thread runnable.
+ *
+ * @param t The thread, which must not be in any queue.
+ */
+static void dl_make_ready(thread_t *t)
+{
+    dl_insert(&dl_ready, t);
+    dl_sched_class.nr_ready++;
+}
+
+/**
+ * @brief Starts a new period of a thread, refilling its runtime.
+ *
+ * @param t The thread.
+ * @param start The start of the period.
+ */
+static void dl_new_period(thread_t *t, uint32_t start)
+{
+    t->dl_release = start;
+    t->dl_abs_deadline = start + t->dl_deadline;
+    t->dl_budget = t->dl_runtime;
+}
+
+/**
+ * @brief Holds a thread back until its next period.
+ *
+ * A thread that is already late for its next period starts it right away.
+ *
+ * @param t The thread, which must not be in any queue.
+ * @param now The scheduler clock.
+ */
+static void dl_throttle(thread_t *t, uint32_t now)
+{
+    uint32_t next = t->dl_release + t->dl_period;
+
+    if (!time_before(now, next)) {
+        dl_new_period(t, now);
+        dl_make_ready(t);
+        return;
+    }
+
+    t->dl_release = next;
+    dl_insert(&dl_wait, t);
+}
+
+/**
+ * @brief Queues a thread of the class.
+ *
+ * A thread that becomes ready after its deadline (or is new) starts a new
+ * period. A thread that gives up the CPU is done with its period and waits
+ * for the next one; so does a preempted thread that has no runtime left.
+ *
+ * @param t The thread.
+ * @param reason Why the thread is queued (SCHED_ENQ_*).
+ */
+static void dl_enqueue(thread_t *t, int reason)
+{
+    uint32_t now = sched_now();
+
+    switch (reason) {
+    case SCHED_ENQ_WAKEUP:
+        if (t->dl_budget == 0 || !time_before(now, t->dl_abs_deadline))
+            dl_new_period(t, now);
+        dl_make_ready(t);
+        break;
+
+    case SCHED_ENQ_YIELD:
+        if (time_before(t->dl_abs_deadline, now))
+            t->dl_misses++;
+        dl_throttle(t, now);
+        break;
+
+    default:
+        if (t->dl_budget == 0)
+            dl_throttle(t, now);
+        else
+            dl_make_ready(t);
+        break;
+    }
+}
+
+/**
+ * @brief Takes a queued thread out of the class.
+ *
+ * @param t The thread, runnable or throttled.
+ */
+static void dl_dequeue(thread_t *t)
+{
+    if (t->rq == &dl_ready)
+        dl_sched_class.nr_ready--;
+    rq_remove(t);
+}
+
+/**
+ * @brief Takes the runnable thread with the earliest deadline.
+ *
+ * @return The thread, or NULL if no thread is runnable.
+ */
+static thread_t *dl_pick_next(void)
+{
+    thread_t *t = dl_ready.rq_head;
+
+    if (t)
+        dl_dequeue(t);
+    return t;
+}
+
+/**
+ * @brief Charges a tick to the running thread's runtime.
+ *
+ * A thread that uses up its runtime has not finished the work of its
+ * period, and cannot run again before its deadline: that is both an
+ * overrun and a miss.
+ *
+ * @param curr The running thread.
+ * @return Nonzero if the thread ran out of runtime or an earlier deadline is runnable.
+ */
+static int dl_tick(thread_t *curr)
+{
+    if (curr->dl_budget > 0)
+        curr->dl_budget--;
+
+    if (curr->dl_budget == 0) {
+        curr->dl_overruns++;
+        curr->dl_misses++;
+        return 1;
+    }
+
+    return dl_ready.rq_head && time_before(dl_ready.rq_head->dl_abs_deadline, curr->dl_abs_deadline);
+}
+
+/**
+ * @brief Starts the periods that are due.
+ *
+ * @param now The scheduler clock.
+ */
+static void dl_clock(uint32_t now)
+{
+    thread_t *t;
+
+    while ((t = dl_wait.rq_head) && !time_before(now, t->dl_release)) {
+        rq_remove(t);
+        dl_new_period(t, t->dl_release);
+        dl_make_ready(t);
+    }
+}
+
+/**
+ * @brief Gives back the bandwidth of a thread that leaves the class.
+ *
+ * @param t The thread.
+ */
+static void dl_switched_from(thread_t *t)
+{
+    dl_total_bw -= t->dl_bw;
+    t->dl_bw = 0;
+}
+
+struct sched_class dl_sched_class = {
+    .name = "deadline",
+    .enqueue = dl_enqueue,
+    .dequeue = dl_dequeue,
+    .pick_next = dl_pick_next,
+    .tick = dl_tick,
+    .clock = dl_clock,
+    .switched_from = dl_switched_from,
+};
+
+/**
+ * @brief Moves a thread to the deadline class, if the CPU can take it.
+ *
+ * Admission control: the sum of runtime / deadline over the deadline
+ * threads, this one included, may not exceed SCHED_DL_BW_MAX. That keeps
+ * every deadline met under EDF, as long as threads stay within their runtime.
+ *
+ * @param t A pointer to the thread structure.
+ * @param runtime CPU ticks the thread needs every period.
+ * @param deadline Ticks from the start of a period by which the runtime must be done.
+ * @param period Ticks between the starts of two periods.
+ * @return 0 on success, or -1 if the deadline threads would need more than SCHED_DL_BW_MAX.
+ */
+int thread_set_deadline(thread_t *t, uint32_t runtime, uint32_t deadline, uint32_t period)
+{
+    uint32_t flags, bw, old_bw;
+    int queued;
+
+    kassert("invalid deadline parameters",
+            runtime > 0 && runtime <= deadline && deadline <= period && deadline < SCHED_DL_BW_ONE);
+
+    bw = (runtime << SCHED_DL_BW_SHIFT) / deadline;
+
+    flags = irq_save();
+
+    old_bw = (t->sched_class == &dl_sched_class) ? t->dl_bw : 0;
+    if (dl_total_bw - old_bw + bw > SCHED_DL_BW_MAX) {
+        irq_restore(flags);
+        return -1;
+    }
+    dl_total_bw = dl_total_bw - old_bw + bw;
+
+    queued = sched_detach(t);
+    t->dl_runtime = runtime;
+    t->dl_deadline = deadline;
+    t->dl_period = period;
+    t->dl_bw = bw;
+    t->dl_budget = 0;
+    sched_attach(t, &dl_sched_class, queued);
+
+    irq_restore(flags);
+
+    return 0;
+}
+
+/**
+ * @brief Prints the deadline statistics of one thread.
+ *
+ * @param t The thread.
+ */
+static void dl_dump_thread(thread_t *t)
+{
+    printk("sched: thread %u: runtime %u, deadline %u, period %u, %u misses, %u overruns\n",
+           t->id, t->dl_runtime, t->dl_deadline, t->dl_period, t->dl_misses, t->dl_overruns);
+}
+
+/**
+ * @brief Prints the deadline statistics of the deadline threads.
+ */
+void sched_dl_dump(void)
+{
+    thread_t *curr = thread_current();
+    thread_t *t;
+    uint32_t flags = irq_save();
+
+    printk("sched: deadline threads use %u%% of the CPU\n", (dl_total_bw * 100) >> SCHED_DL_BW_SHIFT);
+
+    if (curr && curr->sched_class == &dl_sched_class)
+        dl_dump_thread(curr);
+    for (t = dl_ready.rq_head; t; t = t->rq_next)
+        dl_dump_thread(t);
+    for (t = dl_wait.rq_head; t; t = t->rq_next)
+        dl_dump_thread(t);
+
+    irq_restore(flags);
+}
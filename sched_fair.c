@@ -0,0 +1,223 @@
+#include "scheduler.h"
+
+/*
+ * Fair class: weighted fair sharing.
+ *
+ * The ready threads are kept in a treap ordered by virtual runtime (ties
+ * broken by thread id), so queueing, removal and picking the thread with
+ * the smallest virtual runtime all take O(log n) expected time. Virtual
+ * runtimes are 64 bits, so they never wrap around, even at weight 1.
+ */
+
+/* Virtual runtime of one tick at the default weight */
+#define FAIR_GRANULARITY    (SCHED_FAIR_TICK / SCHED_WEIGHT_DEFAULT)
+
+static thread_t *fair_root;             // Root of the treap of ready threads
+static uint64_t min_vruntime;           // Never decreases; where waking threads are placed
+static uint32_t fair_seed = 2463534242; // State of the heap key generator
+
+/**
+ * @brief Returns the next heap key for a treap node (xorshift32).
+ *
+ * @return A pseudo-random key.
+ */
+static uint32_t fair_random(void)
+{
+    fair_seed ^= fair_seed << 13;
+    fair_seed ^= fair_seed >> 17;
+    fair_seed ^= fair_seed << 5;
+    return fair_seed;
+}
+
+/**
+ * @brief Tells whether thread a comes before thread b in the treap.
+ *
+ * @return Nonzero if a has the smaller virtual runtime (or, on a tie, id).
+ */
+static int fair_before(thread_t *a, thread_t *b)
+{
+    return a->vruntime < b->vruntime || (a->vruntime == b->vruntime && a->id < b->id);
+}
+
+/**
+ * @brief Joins two treaps, where every thread of a comes before every thread of b.
+ *
+ * @param a The first treap (may be NULL).
+ * @param b The second treap (may be NULL).
+ * @return The root of the joined treap.
+ */
+static thread_t *fair_merge(thread_t *a, thread_t *b)
+{
+    if (a == 0)
+        return b;
+    if (b == 0)
+        return a;
+
+    if (a->fair_heap > b->fair_heap) {
+        a->fair_right = fair_merge(a->fair_right, b);
+        return a;
+    }
+
+    b->fair_left = fair_merge(a, b->fair_left);
+    return b;
+}
+
+/**
+ * @brief Splits a treap into the threads that come before t and the others.
+ *
+ * @param root The treap.
+ * @param t The thread to split around (not in the treap).
+ * @param left Receives the treap of threads before t.
+ * @param right Receives the treap of threads after t.
+ */
+static void fair_split(thread_t *root, thread_t *t, thread_t **left, thread_t **right)
+{
+    if (root == 0) {
+        *left = *right = 0;
+    } else if (fair_before(root, t)) {
+        *left = root;
+        fair_split(root->fair_right, t, &root->fair_right, right);
+    } else {
+        *right = root;
+        fair_split(root->fair_left, t, left, &root->fair_left);
+    }
+}
+
+/**
+ * @brief Finds the ready thread with the smallest virtual runtime.
+ *
+ * @return The thread, or NULL if no thread is ready.
+ */
+static thread_t *fair_first(void)
+{
+    thread_t *t = fair_root;
+
+    if (t)
+        while (t->fair_left)
+            t = t->fair_left;
+    return t;
+}
+
+/**
+ * @brief Moves min_vruntime up to the smallest virtual runtime still in use.
+ *
+ * @param curr The running thread of the class, or NULL.
+ */
+static void fair_update_min(thread_t *curr)
+{
+    thread_t *first = fair_first();
+    uint64_t v;
+
+    if (curr && (first == 0 || curr->vruntime < first->vruntime))
+        v = curr->vruntime;
+    else if (first)
+        v = first->vruntime;
+    else
+        return;
+
+    if (v > min_vruntime)
+        min_vruntime = v;
+}
+
+/**
+ * @brief Queues a ready thread.
+ *
+ * A thread that was waiting (or is new) is placed no further back than
+ * one tick before min_vruntime, so that sleeping does not bank CPU time.
+ *
+ * @param t The thread.
+ * @param reason Why the thread is queued (SCHED_ENQ_*).
+ */
+static void fair_enqueue(thread_t *t, int reason)
+{
+    thread_t *left, *right;
+
+    if (reason == SCHED_ENQ_WAKEUP) {
+        uint64_t floor = min_vruntime - FAIR_GRANULARITY;
+        if (min_vruntime >= FAIR_GRANULARITY && t->vruntime < floor)
+            t->vruntime = floor;
+    }
+
+    t->fair_heap = fair_random();
+    t->fair_left = t->fair_right = 0;
+
+    fair_split(fair_root, t, &left, &right);
+    fair_root = fair_merge(fair_merge(left, t), right);
+    fair_sched_class.nr_ready++;
+}
+
+/**
+ * @brief Takes a thread out of the treap.
+ *
+ * @param t The thread, which must be in the treap.
+ */
+static void fair_dequeue(thread_t *t)
+{
+    thread_t **link = &fair_root;
+
+    while (*link != t)
+        link = fair_before(t, *link) ? &(*link)->fair_left : &(*link)->fair_right;
+
+    *link = fair_merge(t->fair_left, t->fair_right);
+    t->fair_left = t->fair_right = 0;
+    fair_sched_class.nr_ready--;
+}
+
+/**
+ * @brief Takes the ready thread with the smallest virtual runtime.
+ *
+ * @return The thread, or NULL if no thread is ready.
+ */
+static thread_t *fair_pick_next(void)
+{
+    thread_t *t = fair_first();
+
+    if (t) {
+        fair_dequeue(t);
+        fair_update_min(t);
+    }
+    return t;
+}
+
+/**
+ * @brief Charges a tick to the running thread, in proportion to its weight.
+ *
+ * The thread makes way once it is more than a tick's worth of virtual
+ * runtime ahead of the first ready thread.
+ *
+ * @param curr The running thread.
+ * @return Nonzero if another thread should run.
+ */
+static int fair_tick(thread_t *curr)
+{
+    thread_t *first;
+
+    curr->vruntime += SCHED_FAIR_TICK / curr->weight;
+    fair_update_min(curr);
+
+    first = fair_first();
+    return first && curr->vruntime > first->vruntime + FAIR_GRANULARITY;
+}
+
+/**
+ * @brief Starts a thread that joins the class at min_vruntime.
+ *
+ * Whatever virtual runtime the thread had from an earlier stay in the class
+ * is stale: kept, it would let the thread run alone for as long as it was
+ * away, or hold it back as long.
+ *
+ * @param t The thread.
+ */
+static void fair_switched_to(thread_t *t)
+{
+    t->vruntime = min_vruntime;
+}
+
+struct sched_class fair_sched_class = {
+    .name = "fair",
+    .enqueue = fair_enqueue,
+    .dequeue = fair_dequeue,
+    .pick_next = fair_pick_next,
+    .tick = fair_tick,
+    .switched_to = fair_switched_to,
+};
@@ -0,0 +1,64 @@
+#include "scheduler.h"
+
+/*
+ * Idle class: threads that only run when no other class has a ready
+ * thread, taking turns every tick.
+ */
+
+static struct run_queue idle_queue;     // The queue of ready idle threads
+
+/**
+ * @brief Queues a ready idle thread.
+ *
+ * @param t The thread.
+ * @param reason Why the thread is queued (unused).
+ */
+static void idle_enqueue(thread_t *t, int reason)
+{
+    rq_enqueue(&idle_queue, t);
+    idle_sched_class.nr_ready++;
+}
+
+/**
+ * @brief Takes a queued idle thread out of the class.
+ *
+ * @param t The thread.
+ */
+static void idle_dequeue(thread_t *t)
+{
+    rq_remove(t);
+    idle_sched_class.nr_ready--;
+}
+
+/**
+ * @brief Takes the first ready idle thread.
+ *
+ * @return The thread, or NULL if no idle thread is ready.
+ */
+static thread_t *idle_pick_next(void)
+{
+    thread_t *t = idle_queue.rq_head;
+
+    if (t)
+        idle_dequeue(t);
+    return t;
+}
+
+/**
+ * @brief Charges a tick to the running idle thread.
+ *
+ * @param curr The running thread.
+ * @return Nonzero if another idle thread is waiting for its turn.
+ */
+static int idle_tick(thread_t *curr)
+{
+    return idle_queue.rq_head != 0;
+}
+
+struct sched_class idle_sched_class = {
+    .name = "idle",
+    .enqueue = idle_enqueue,
+    .dequeue = idle_dequeue,
+    .pick_next = idle_pick_next,
+    .tick = idle_tick,
+};
@@ -0,0 +1,171 @@
+#include "scheduler.h"
+
+/*
+ * Priority class: multi-level feedback queues.
+ *
+ * One run queue per priority, plus a bitmap of the non-empty ones, so the
+ * highest priority ready thread is found with a single bit scan. See
+ * scheduler.h for the feedback rules.
+ */
+
+static struct run_queue ready_queues[SCHED_PRIORITIES]; // One queue of ready threads per priority
+static uint32_t ready_bitmap;           // Bit p is set when ready_queues[p] is not empty
+static uint32_t prio_ticks;             // Ticks charged to threads of this class
+
+/**
+ * @brief Queues a ready thread at its priority, with a fresh time slice if it has none left.
+ *
+ * @param t The thread, which must not be in any queue.
+ */
+static void ready_enqueue(thread_t *t)
+{
+    if (t->slice == 0)
+        t->slice = SCHED_SLICE(t->priority);
+
+    rq_enqueue(&ready_queues[t->priority], t);
+    ready_bitmap |= 1 << t->priority;
+}
+
+/**
+ * @brief Takes a thread out of the ready queues.
+ *
+ * @param t The thread, which must be in a ready queue.
+ */
+static void ready_remove(thread_t *t)
+{
+    uint32_t priority = t->priority;
+
+    rq_remove(t);
+    if (ready_queues[priority].rq_head == 0)
+        ready_bitmap &= ~(1 << priority);
+}
+
+/**
+ * @brief Returns the highest priority with a ready thread.
+ *
+ * @return The priority, or -1 if no thread is ready.
+ */
+static int ready_highest(void)
+{
+    if (ready_bitmap == 0)
+        return -1;
+
+    // The highest set bit is the highest priority with a ready thread (bsr)
+    return 31 - __builtin_clz(ready_bitmap);
+}
+
+/**
+ * @brief Puts every thread of the class back at its base priority.
+ *
+ * Walks all the ready queues, but only once every SCHED_BOOST_TICKS ticks.
+ *
+ * @param curr The running thread, which belongs to this class.
+ */
+static void boost_all(thread_t *curr)
+{
+    thread_t *t, *next;
+    uint32_t p;
+
+    for (p = 0; p < SCHED_PRIORITIES; p++) {
+        for (t = ready_queues[p].rq_head; t; t = next) {
+            next = t->rq_next;
+            if (t->priority < t->base_priority) {
+                ready_remove(t);
+                t->priority = t->base_priority;
+                t->slice = 0;
+                ready_enqueue(t);
+            }
+        }
+    }
+
+    if (curr->priority < curr->base_priority) {
+        curr->priority = curr->base_priority;
+        curr->slice = SCHED_SLICE(curr->priority);
+    }
+}
+
+/**
+ * @brief Queues a ready thread.
+ *
+ * A thread that was waiting or gave up the CPU early climbs one priority
+ * level (up to its base priority) and gets a fresh time slice. A preempted
+ * thread keeps what is left of its slice.
+ *
+ * @param t The thread.
+ * @param reason Why the thread is queued (SCHED_ENQ_*).
+ */
+static void prio_enqueue(thread_t *t, int reason)
+{
+    if (reason != SCHED_ENQ_PREEMPT) {
+        if (t->priority < t->base_priority)
+            t->priority++;
+        t->slice = 0;
+    }
+
+    ready_enqueue(t);
+    prio_sched_class.nr_ready++;
+}
+
+/**
+ * @brief Takes a queued thread out of the class.
+ *
+ * @param t The thread.
+ */
+static void prio_dequeue(thread_t *t)
+{
+    ready_remove(t);
+    prio_sched_class.nr_ready--;
+}
+
+/**
+ * @brief Takes the first thread of the highest priority ready queue.
+ *
+ * @return The thread, or NULL if no thread is ready.
+ */
+static thread_t *prio_pick_next(void)
+{
+    int p = ready_highest();
+    thread_t *t;
+
+    if (p < 0)
+        return 0;
+
+    t = ready_queues[p].rq_head;
+    prio_dequeue(t);
+    return t;
+}
+
+/**
+ * @brief Charges a tick to the running thread.
+ *
+ * A thread that used up its time slice drops one priority level (but not
+ * below SCHED_PRIO_MIN) and must make way. A thread with time left keeps
+ * running unless a higher priority thread is ready.
+ *
+ * @param curr The running thread.
+ * @return Nonzero if another thread should run.
+ */
+static int prio_tick(thread_t *curr)
+{
+    if (++prio_ticks % SCHED_BOOST_TICKS == 0)
+        boost_all(curr);
+
+    if (curr->slice > 0)
+        curr->slice--;
+
+    if (curr->slice == 0) {
+        if (curr->priority > SCHED_PRIO_MIN)
+            curr->priority--;
+        return 1;
+    }
+
+    return ready_highest() > (int)curr->priority;
+}
+
+struct sched_class prio_sched_class = {
+    .name = "prio",
+    .enqueue = prio_enqueue,
+    .dequeue = prio_dequeue,
+    .pick_next = prio_pick_next,
+    .tick = prio_tick,
+};
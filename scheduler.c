@@ -1,9 +1,230 @@
 #include "scheduler.h"
-#include "kmalloc.h"
 
-// Global variables for the scheduler
-thread_list_t *ready_queue = 0;     // Points to the queue of ready threads
-thread_list_t *current_thread = 0; // Points to the currently running thread
+/*
+ * Scheduler core. The policies live in scheduling classes (sched_prio.c,
+ * sched_fair.c, sched_idle.c); the core keeps track of which threads are
+ * queued and asks the classes, highest first, for the next thread to run.
+ * Everything here runs with interrupts disabled.
+ */
+
+// Scheduling classes, from the one that runs first to the one that runs last
+static struct sched_class *sched_classes[] = {
+    &dl_sched_class,
+    &prio_sched_class,
+    &fair_sched_class,
+    &idle_sched_class,
+};
+
+thread_t *current_thread = 0;           // The currently running thread (used by switch_thread)
+static uint32_t sched_clock;            // Timer ticks seen by schedule_tick()
+
+/**
+ * @brief Appends a thread to the back of a run queue.
+ *
+ * @param rq The run queue.
+ * @param t The thread, which must not be in any queue.
+ */
+void rq_enqueue(struct run_queue *rq, thread_t *t)
+{
+    rq_insert(rq, t, 0);
+}
+
+/**
+ * @brief Inserts a thread in a run queue, in front of another one.
+ *
+ * @param rq The run queue.
+ * @param t The thread, which must not be in any queue.
+ * @param before The thread of `rq` to insert in front of, or NULL to append.
+ */
+void rq_insert(struct run_queue *rq, thread_t *t, thread_t *before)
+{
+    t->rq = rq;
+    t->rq_next = before;
+    t->rq_prev = before ? before->rq_prev : rq->rq_tail;
+
+    if (t->rq_prev)
+        t->rq_prev->rq_next = t;
+    else
+        rq->rq_head = t;
+
+    if (before)
+        before->rq_prev = t;
+    else
+        rq->rq_tail = t;
+    rq->rq_count++;
+}
+
+/**
+ * @brief Unlinks a thread from the run queue that holds it.
+ *
+ * @param t The thread, which must be in a queue.
+ */
+void rq_remove(thread_t *t)
+{
+    struct run_queue *rq = t->rq;
+
+    if (t->rq_prev)
+        t->rq_prev->rq_next = t->rq_next;
+    else
+        rq->rq_head = t->rq_next;
+
+    if (t->rq_next)
+        t->rq_next->rq_prev = t->rq_prev;
+    else
+        rq->rq_tail = t->rq_prev;
+
+    t->rq = 0;
+    t->rq_next = t->rq_prev = 0;
+    rq->rq_count--;
+}
+
+/**
+ * @brief Queues a ready thread in its class.
+ *
+ * @param t The thread, which must not be queued.
+ * @param reason Why the thread is queued (SCHED_ENQ_*).
+ */
+static void enqueue_thread(thread_t *t, int reason)
+{
+    t->sched_class->enqueue(t, reason);
+    t->on_rq = 1;
+}
+
+/**
+ * @brief Takes a queued thread out of its class.
+ *
+ * @param t The thread, which must be queued.
+ */
+static void dequeue_thread(thread_t *t)
+{
+    t->sched_class->dequeue(t);
+    t->on_rq = 0;
+}
+
+/**
+ * @brief Takes the next thread to run from the highest class with a ready thread.
+ *
+ * @return The thread, or NULL if no thread is ready.
+ */
+static thread_t *pick_next_thread(void)
+{
+    struct sched_class *cls;
+    thread_t *t;
+    uint32_t i;
+
+    for (i = 0; i < array_size(sched_classes); i++) {
+        cls = sched_classes[i];
+        if (cls->nr_ready == 0)
+            continue;
+
+        t = cls->pick_next();
+        t->on_rq = 0;
+        return t;
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Tells whether a class that runs before `cls` has a ready thread.
+ *
+ * @param cls The class of the running thread.
+ * @return Nonzero if the running thread should make way.
+ */
+static int higher_class_ready(struct sched_class *cls)
+{
+    uint32_t i;
+
+    for (i = 0; sched_classes[i] != cls; i++)
+        if (sched_classes[i]->nr_ready)
+            return 1;
+
+    return 0;
+}
+
+/**
+ * @brief Switches to the next thread to run, which may be the running one.
+ *
+ * The running thread is either queued in its class or blocked, so it may
+ * not be runnable yet (a throttled deadline thread, for instance). If no
+ * thread is ready, the CPU halts until an interrupt makes one ready; the
+ * running thread is back on the CPU when this returns.
+ */
+static void switch_to_next(void)
+{
+    thread_t *new_thread;
+
+    while ((new_thread = pick_next_thread()) == 0)
+        asm volatile ("sti; hlt; cli");
+
+    if (new_thread != current_thread)
+        switch_thread(new_thread);
+}
+
+/**
+ * @brief Puts the running thread back in its class and switches to the
+ *        next thread to run, which may be the same one.
+ *
+ * @param reason Why the running thread is queued (SCHED_ENQ_*).
+ */
+static void reschedule(int reason)
+{
+    enqueue_thread(current_thread, reason);
+    switch_to_next();
+}
+
+/**
+ * @brief Switches away from the running thread, which has been marked blocked.
+ *
+ * The thread is not queued again.
+ */
+static void block_current(void)
+{
+    switch_to_next();
+}
+
+/**
+ * @brief Takes a thread out of its class before its class or parameters change.
+ *
+ * Must be called with interrupts disabled, followed by sched_attach().
+ *
+ * @param t The thread.
+ * @return Nonzero if the thread was queued.
+ */
+int sched_detach(thread_t *t)
+{
+    if (!t->on_rq)
+        return 0;
+
+    dequeue_thread(t);
+    return 1;
+}
+
+/**
+ * @brief Puts a thread taken out by sched_detach() in its (new) class.
+ *
+ * The running thread is queued again at once, so that it is placed by its
+ * new class and the right thread runs next.
+ *
+ * @param t The thread.
+ * @param cls The class of the thread from now on.
+ * @param queued The value returned by sched_detach().
+ */
+void sched_attach(thread_t *t, struct sched_class *cls, int queued)
+{
+    if (t->sched_class != cls) {
+        if (t->sched_class->switched_from)
+            t->sched_class->switched_from(t);
+        t->sched_class = cls;
+        if (cls->switched_to)
+            cls->switched_to(t);
+    }
+
+    if (queued)
+        enqueue_thread(t, SCHED_ENQ_WAKEUP);
+    else if (t == current_thread)
+        reschedule(SCHED_ENQ_WAKEUP);
+}
 
 /**
  * @brief Initializes the scheduler with the initial thread.
@@ -12,103 +233,229 @@ thread_list_t *current_thread = 0; // Points to the currently running thread
  */
 void init_scheduler(thread_t *initial_thread)
 {
-    // Allocate memory for the current thread node
-    current_thread = (thread_list_t *)kmalloc(sizeof(thread_list_t));
-    current_thread->thread = initial_thread;
-    current_thread->next = 0; // No next thread initially
-    ready_queue = 0;          // Initialize the ready queue as empty
+    // Let the thread's class set it up as if it had just been picked
+    enqueue_thread(initial_thread, SCHED_ENQ_WAKEUP);
+    current_thread = pick_next_thread();
 }
 
 /**
- * @brief Adds a thread to the ready queue, marking it as ready to run.
+ * @brief Adds a thread to its class, marking it as ready to run.
  *
  * @param t A pointer to the thread structure for the thread to add.
  */
 void thread_is_ready(thread_t *t)
 {
-    // Allocate memory for the new thread node
-    thread_list_t *item = (thread_list_t *)kmalloc(sizeof(thread_list_t));
-    item->thread = t;
-    item->next = 0;
+    uint32_t flags = irq_save();
 
-    if (!ready_queue)
-    {
-        // If the ready queue is empty, set the new thread as the head
-        ready_queue = item;
-    }
-    else
-    {
-        // Traverse to the end of the ready queue
-        thread_list_t *iterator = ready_queue;
-        while (iterator->next)
-        {
-            iterator = iterator->next;
-        }
-
-        // Add the new thread to the end of the queue
-        iterator->next = item;
-    }
+    if (t->state == THREAD_BLOCKED)
+        thread_wake(t);
+    else if (!t->on_rq && t != current_thread)
+        enqueue_thread(t, SCHED_ENQ_WAKEUP);
+
+    irq_restore(flags);
 }
 
 /**
- * @brief Removes a thread from the ready queue, marking it as not ready to run.
+ * @brief Removes a thread from its class, marking it as not ready to run.
  *
  * @param t A pointer to the thread structure for the thread to remove.
  */
 void thread_not_ready(thread_t *t)
 {
-    // Pointer to traverse the ready queue
-    thread_list_t *iterator = ready_queue;
+    uint32_t flags = irq_save();
+
+    if (t->on_rq)
+        dequeue_thread(t);
+
+    irq_restore(flags);
+}
+
+/**
+ * @brief Blocks the running thread until thread_wake() is called on it.
+ */
+void thread_block(void)
+{
+    uint32_t flags = irq_save();
+
+    current_thread->state = THREAD_BLOCKED;
+    block_current();
+
+    irq_restore(flags);
+}
+
+/**
+ * @brief Ends the sleep of a thread (runs from the timer interrupt).
+ *
+ * @param arg The sleeping thread.
+ */
+static void sleep_expired(void *arg)
+{
+    thread_wake((thread_t *)arg);
+}
+
+/**
+ * @brief Blocks the running thread for a number of timer ticks.
+ *
+ * @param ticks Number of ticks to sleep; 0 just gives up the CPU.
+ */
+void thread_sleep(uint32_t ticks)
+{
+    uint32_t flags = irq_save();
 
-    // Special case: if the thread is at the head of the queue
-    if (iterator && iterator->thread == t)
-    {
-        ready_queue = iterator->next; // Update the head of the queue
-        kfree(iterator);              // Free the memory of the removed node
-        return;
+    if (ticks == 0) {
+        schedule();
+    } else {
+        timeout_set(&current_thread->sleep, ticks, sleep_expired, current_thread);
+        current_thread->state = THREAD_BLOCKED;
+        block_current();
     }
 
-    // Traverse the queue to find the thread
-    while (iterator && iterator->next)
-    {
-        if (iterator->next->thread == t)
-        {
-            // Found the thread, remove it
-            thread_list_t *tmp = iterator->next;
-            iterator->next = tmp->next; // Update the next pointer
-            kfree(tmp);                 // Free the memory of the removed node
-            return;
-        }
-        iterator = iterator->next;
+    irq_restore(flags);
+}
+
+/**
+ * @brief Makes a blocked thread ready again, cancelling its sleep.
+ *
+ * @param t A pointer to the thread structure.
+ */
+void thread_wake(thread_t *t)
+{
+    uint32_t flags = irq_save();
+
+    if (t->state == THREAD_BLOCKED) {
+        timeout_cancel(&t->sleep);
+        t->state = THREAD_READY;
+        enqueue_thread(t, SCHED_ENQ_WAKEUP);
     }
+
+    irq_restore(flags);
 }
 
 /**
- * @brief Performs a context switch to the next thread in the ready queue.
+ * @brief Returns the scheduler clock.
  *
- * Moves the currently running thread to the end of the ready queue
- * and switches to the thread at the head of the queue.
+ * @return The number of timer ticks since the scheduler was initialized.
+ */
+uint32_t sched_now(void)
+{
+    return sched_clock;
+}
+
+/**
+ * @brief Returns the thread that is currently running.
+ *
+ * @return Pointer to the running thread, or NULL before the scheduler is initialized.
+ */
+thread_t *thread_current(void)
+{
+    return current_thread;
+}
+
+/**
+ * @brief Moves a thread to the priority class, at the given base priority.
+ *
+ * @param t A pointer to the thread structure.
+ * @param priority The new priority, from SCHED_PRIO_MIN to SCHED_PRIO_MAX.
+ */
+void thread_set_priority(thread_t *t, uint32_t priority)
+{
+    uint32_t flags;
+    int queued;
+
+    kassert("priority out of range", priority <= SCHED_PRIO_MAX);
+
+    flags = irq_save();
+
+    queued = sched_detach(t);
+    t->priority = t->base_priority = priority;
+    t->slice = 0;
+    sched_attach(t, &prio_sched_class, queued);
+
+    irq_restore(flags);
+}
+
+/**
+ * @brief Moves a thread to the fair class, with the given weight.
+ *
+ * @param t A pointer to the thread structure.
+ * @param weight The thread's CPU share, from 1 to SCHED_WEIGHT_MAX.
+ */
+void thread_set_weight(thread_t *t, uint32_t weight)
+{
+    uint32_t flags;
+    int queued;
+
+    kassert("weight out of range", weight > 0 && weight <= SCHED_WEIGHT_MAX);
+
+    flags = irq_save();
+
+    queued = sched_detach(t);
+    t->weight = weight;
+    sched_attach(t, &fair_sched_class, queued);
+
+    irq_restore(flags);
+}
+
+/**
+ * @brief Moves a thread to the idle class.
+ *
+ * @param t A pointer to the thread structure.
+ */
+void thread_set_idle(thread_t *t)
+{
+    sched_set_class(t, &idle_sched_class);
+}
+
+/**
+ * @brief Moves a thread to another scheduling class.
+ *
+ * @param t A pointer to the thread structure.
+ * @param cls The new class.
+ */
+void sched_set_class(thread_t *t, struct sched_class *cls)
+{
+    uint32_t flags = irq_save();
+
+    sched_attach(t, cls, sched_detach(t));
+
+    irq_restore(flags);
+}
+
+/**
+ * @brief Gives up the CPU to the next thread to run.
+ *
+ * The current thread is queued again in its class, which decides whether
+ * giving up the CPU early earns it anything.
  */
 void schedule()
 {
-    // If there are no threads in the ready queue, return
-    if (!ready_queue) return;
+    // Even with nothing else ready: a deadline thread must be held back until its next period
+    reschedule(SCHED_ENQ_YIELD);
+}
 
-    // Traverse to the end of the ready queue
-    thread_list_t *iterator = ready_queue;
-    while (iterator->next)
-    {
-        iterator = iterator->next;
-    }
+/**
+ * @brief Charges a timer tick to the running thread.
+ *
+ * Advances the scheduler clock for the classes that keep time, then lets
+ * the running thread's class decide whether it has had its share; a ready
+ * thread in a higher class always takes over.
+ */
+void schedule_tick(void)
+{
+    thread_t *t = current_thread;
+    uint32_t i;
+
+    // Nothing to do before the scheduler is initialized
+    if (t == 0) return;
 
-    // Move the current thread to the end of the ready queue
-    iterator->next = current_thread;
-    current_thread->next = 0; // Current thread becomes the last node
+    sched_clock++;
+    for (i = 0; i < array_size(sched_classes); i++)
+        if (sched_classes[i]->clock)
+            sched_classes[i]->clock(sched_clock);
 
-    // Take the first thread from the ready queue
-    thread_list_t *new_thread = ready_queue;
-    ready_queue = ready_queue->next; // Update the head of the queue
+    // A blocked or queued thread is waiting in switch_to_next() for a thread to become ready
+    if (t->state == THREAD_BLOCKED || t->on_rq) return;
 
-    // Switch to the new thread
-    switch_thread(new_thread);
+    if (t->sched_class->tick(t) || higher_class_ready(t->sched_class))
+        reschedule(SCHED_ENQ_PREEMPT);
 }
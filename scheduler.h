@@ -5,37 +5,248 @@
 #include "thread.h"
 
 /**
- * @brief Represents a node in the list of threads managed by the scheduler.
+ * @brief A queue of threads, linked through the rq_next/rq_prev fields of
+ *        the threads themselves, so queueing never allocates.
  */
-typedef struct thread_list {
-    thread_t *thread;           /**< Pointer to the thread associated with this list node. */
-    struct thread_list *next;   /**< Pointer to the next node in the thread list. */
-} thread_list_t;
+struct run_queue {
+    thread_t *rq_head;          /**< Thread at the front of the queue (runs first). */
+    thread_t *rq_tail;          /**< Thread at the back of the queue. */
+    uint32_t rq_count;          /**< Number of threads in the queue. */
+};
+
+/* Reasons for sched_class.enqueue() */
+#define SCHED_ENQ_PREEMPT   0   /* The running thread was preempted */
+#define SCHED_ENQ_WAKEUP    1   /* The thread became ready (or is new) */
+#define SCHED_ENQ_YIELD     2   /* The running thread gave up the CPU early */
+
+/**
+ * @brief A scheduling policy.
+ *
+ * Every thread belongs to one class. The classes are tried in a fixed
+ * order (see sched_classes in scheduler.c) and the first one with a ready
+ * thread picks the next thread to run. The core keeps track of which
+ * threads are queued (on_rq); a class may hold queued threads that cannot
+ * run yet, so it counts the runnable ones itself in nr_ready. The callbacks
+ * run with interrupts disabled.
+ */
+struct sched_class {
+    const char *name;                               /**< Name, for debugging. */
+    void (*enqueue)(thread_t *t, int reason);       /**< Queues a ready thread (SCHED_ENQ_*). */
+    void (*dequeue)(thread_t *t);                   /**< Takes a queued thread out of the class. */
+    thread_t *(*pick_next)(void);                   /**< Takes the thread to run next out of the class. */
+    int (*tick)(thread_t *curr);                    /**< Charges a tick to the running thread; nonzero to switch. */
+    void (*clock)(uint32_t now);                    /**< Called on every tick with the scheduler clock (optional). */
+    void (*switched_from)(thread_t *t);             /**< Called when a thread leaves the class (optional). */
+    void (*switched_to)(thread_t *t);               /**< Called when a thread joins the class (optional). */
+    uint32_t nr_ready;                              /**< Number of threads pick_next() can return. */
+};
+
+/*
+ * Priority class. Each priority has its own run queue and the highest
+ * non-empty one runs first. A thread that uses up its time slice drops one
+ * level, and one that gives up the CPU early climbs back towards its base
+ * priority. Every SCHED_BOOST_TICKS ticks all threads are put back at their
+ * base priority, so CPU-bound threads cannot starve.
+ */
+#define SCHED_PRIORITIES    32  /* Number of priorities (one bit each in the ready bitmap) */
+#define SCHED_PRIO_MIN      0   /* Lowest priority */
+#define SCHED_PRIO_DEFAULT  16  /* Priority of new threads */
+#define SCHED_PRIO_MAX      31  /* Highest priority */
+#define SCHED_BOOST_TICKS   100 /* Ticks between two priority boosts */
+
+/* Time slice of priority `p`, in timer ticks: high priorities switch more often */
+#define SCHED_SLICE(p)      (1 + (SCHED_PRIORITIES - 1 - (p)) / 4)
+
+/*
+ * Fair class. Threads share the CPU in proportion to their weights: a
+ * thread's virtual runtime grows by SCHED_FAIR_TICK / weight per tick, and
+ * the thread with the smallest virtual runtime runs next.
+ */
+#define SCHED_WEIGHT_DEFAULT    1024    /* Weight of new threads */
+#define SCHED_FAIR_TICK         (SCHED_WEIGHT_DEFAULT * SCHED_WEIGHT_DEFAULT)
+#define SCHED_WEIGHT_MAX        SCHED_FAIR_TICK
+
+/*
+ * Deadline class: earliest deadline first, with a constant bandwidth server
+ * per thread. A thread asks for `runtime` ticks of CPU within `deadline`
+ * ticks of the start of every `period` ticks, and calls schedule() when the
+ * work of a period is done. A thread that uses up its runtime is throttled
+ * until its next period, so it cannot take more than its share. The sum of
+ * runtime / deadline over all deadline threads may not exceed
+ * SCHED_DL_BW_MAX, in 1/SCHED_DL_BW_ONE units.
+ */
+#define SCHED_DL_BW_SHIFT   16
+#define SCHED_DL_BW_ONE     (1 << SCHED_DL_BW_SHIFT)
+#define SCHED_DL_BW_MAX     (SCHED_DL_BW_ONE * 95 / 100)    /* Leave 5% to the other classes */
+
+extern struct sched_class dl_sched_class;      /* Earliest deadline first (runs before all others) */
+extern struct sched_class prio_sched_class;    /* Multi-level feedback priorities (default) */
+extern struct sched_class fair_sched_class;    /* Weighted fair sharing */
+extern struct sched_class idle_sched_class;    /* Runs only when no other class has a ready thread */
+
+/**
+ * @brief Appends a thread to the back of a run queue.
+ *
+ * @param rq The run queue.
+ * @param t The thread, which must not be in any queue.
+ */
+void rq_enqueue(struct run_queue *rq, thread_t *t);
+
+/**
+ * @brief Inserts a thread in a run queue, in front of another one.
+ *
+ * @param rq The run queue.
+ * @param t The thread, which must not be in any queue.
+ * @param before The thread of `rq` to insert in front of, or NULL to append.
+ */
+void rq_insert(struct run_queue *rq, thread_t *t, thread_t *before);
+
+/**
+ * @brief Unlinks a thread from the run queue that holds it.
+ *
+ * @param t The thread, which must be in a queue.
+ */
+void rq_remove(thread_t *t);
+
+/**
+ * @brief Takes a thread out of its class before its class or parameters change.
+ *
+ * Must be called with interrupts disabled, followed by sched_attach().
+ *
+ * @param t Pointer to the thread.
+ * @return Nonzero if the thread was queued.
+ */
+int sched_detach(thread_t *t);
+
+/**
+ * @brief Puts a thread taken out by sched_detach() in its (new) class.
+ *
+ * @param t Pointer to the thread.
+ * @param cls The class of the thread from now on.
+ * @param queued The value returned by sched_detach().
+ */
+void sched_attach(thread_t *t, struct sched_class *cls, int queued);
+
+/**
+ * @brief Returns the scheduler clock.
+ *
+ * @return The number of timer ticks since the scheduler was initialized.
+ */
+uint32_t sched_now(void);
 
 /**
  * @brief Initializes the scheduler with the given initial thread.
- * 
+ *
  * @param initial_thread Pointer to the thread to be set as the initial thread.
  */
 void init_scheduler(thread_t *initial_thread);
 
 /**
  * @brief Marks a thread as ready for execution.
- * 
+ *
  * @param t Pointer to the thread to mark as ready.
  */
 void thread_is_ready(thread_t *t);
 
 /**
  * @brief Marks a thread as not ready for execution.
- * 
+ *
  * @param t Pointer to the thread to mark as not ready.
  */
 void thread_not_ready(thread_t *t);
 
 /**
- * @brief Performs the scheduling operation to decide the next thread to execute.
+ * @brief Returns the thread that is currently running.
+ *
+ * @return Pointer to the running thread, or NULL before the scheduler is initialized.
+ */
+thread_t *thread_current(void);
+
+/**
+ * @brief Blocks the running thread until thread_wake() is called on it.
+ *
+ * The thread is off the run queues while it waits. Callers check their
+ * wait condition and block with interrupts disabled, so that a wakeup
+ * cannot slip in between.
+ */
+void thread_block(void);
+
+/**
+ * @brief Blocks the running thread for a number of timer ticks.
+ *
+ * @param ticks Number of ticks to sleep; 0 just gives up the CPU.
+ */
+void thread_sleep(uint32_t ticks);
+
+/**
+ * @brief Makes a blocked thread ready again, cancelling its sleep.
+ *
+ * May be called from interrupt handlers. Does nothing if the thread is not blocked.
+ *
+ * @param t Pointer to the thread.
+ */
+void thread_wake(thread_t *t);
+
+/**
+ * @brief Moves a thread to the priority class, at the given base priority.
+ *
+ * @param t Pointer to the thread.
+ * @param priority The new priority, from SCHED_PRIO_MIN to SCHED_PRIO_MAX.
+ */
+void thread_set_priority(thread_t *t, uint32_t priority);
+
+/**
+ * @brief Moves a thread to the fair class, with the given weight.
+ *
+ * @param t Pointer to the thread.
+ * @param weight The thread's CPU share, from 1 to SCHED_WEIGHT_MAX.
+ */
+void thread_set_weight(thread_t *t, uint32_t weight);
+
+/**
+ * @brief Moves a thread to the deadline class, if the CPU can take it.
+ *
+ * All times are in timer ticks, with 0 < runtime <= deadline <= period.
+ *
+ * @param t Pointer to the thread.
+ * @param runtime CPU time the thread needs every period.
+ * @param deadline Time from the start of a period by which the runtime must be done.
+ * @param period Time between the starts of two periods.
+ * @return 0 on success, or -1 if the deadline threads would need more than SCHED_DL_BW_MAX.
+ */
+int thread_set_deadline(thread_t *t, uint32_t runtime, uint32_t deadline, uint32_t period);
+
+/**
+ * @brief Prints the deadline statistics of the deadline threads.
+ */
+void sched_dl_dump(void);
+
+/**
+ * @brief Moves a thread to the idle class.
+ *
+ * @param t Pointer to the thread.
+ */
+void thread_set_idle(thread_t *t);
+
+/**
+ * @brief Moves a thread to another scheduling class.
+ *
+ * @param t Pointer to the thread.
+ * @param cls The new class.
+ */
+void sched_set_class(thread_t *t, struct sched_class *cls);
+
+/**
+ * @brief Gives up the CPU to the next thread of the highest class with a ready thread.
  */
 void schedule();
 
+/**
+ * @brief Charges a timer tick to the running thread.
+ *
+ * Called from the timer interrupt. Switches threads when the running
+ * thread's class says so or a higher class has a ready thread.
+ */
+void schedule_tick(void);
+
 #endif /* SCHEDULER_H */
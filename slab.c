@@ -0,0 +1,225 @@
+#include "slab.h"
+#include "kmalloc.h"
+
+/* Round `x` up to a multiple of `a` (a power of two) */
+#define ALIGN_UP(x, a)  (((x) + (a) - 1) & ~((a) - 1))
+
+/**
+ * slab_list_add - Pushes a slab onto the head of a cache list.
+ *
+ * @head: The list head.
+ * @slab: The slab to add.
+ */
+static void slab_list_add(struct kmem_slab **head, struct kmem_slab *slab)
+{
+    slab->s_prev = NULL;
+    slab->s_next = *head;
+    if (*head != NULL)
+        (*head)->s_prev = slab;
+    *head = slab;
+}
+
+/**
+ * slab_list_del - Unlinks a slab from a cache list.
+ *
+ * @head: The list head.
+ * @slab: The slab to remove.
+ */
+static void slab_list_del(struct kmem_slab **head, struct kmem_slab *slab)
+{
+    if (slab->s_next != NULL)
+        slab->s_next->s_prev = slab->s_prev;
+    if (slab->s_prev != NULL)
+        slab->s_prev->s_next = slab->s_next;
+    else
+        *head = slab->s_next;
+}
+
+/**
+ * slab_object - Returns the address of object `i` of a slab.
+ *
+ * @cache: The cache the slab belongs to.
+ * @slab:  The slab.
+ * @i:     Index of the object.
+ */
+static void *slab_object(struct kmem_cache *cache, struct kmem_slab *slab, uint32_t i)
+{
+    return (void *)((uint32_t)slab + cache->c_offset + i * cache->c_size);
+}
+
+/**
+ * slab_grow - Takes a new page from the heap and carves it into objects.
+ *
+ * @cache: The cache to grow.
+ *
+ * Returns the new slab, already on the empty list.
+ */
+static struct kmem_slab *slab_grow(struct kmem_cache *cache)
+{
+    struct kmem_slab *slab = kmalloc_a(KMEM_SLAB_SIZE);
+    uint32_t i;
+
+    if (slab == NULL)
+        panic("kmalloc");
+
+    slab->s_cache = cache;
+    slab->s_inuse = 0;
+    slab->s_free = 0;
+
+    // Chain every object onto the free list and construct it
+    for (i = 0; i < cache->c_per_slab; i++) {
+        slab->s_chain[i] = (i + 1 < cache->c_per_slab) ? i + 1 : KMEM_FREE_END;
+        if (cache->c_ctor != NULL)
+            cache->c_ctor(slab_object(cache, slab, i));
+    }
+
+    slab_list_add(&cache->c_empty, slab);
+    cache->c_slabs++;
+    cache->c_grows++;
+
+    return slab;
+}
+
+/**
+ * kmem_cache_create - Creates a cache of equally sized objects.
+ *
+ * @name:  Name of the cache.
+ * @size:  Size of each object.
+ * @align: Object alignment (power of two, 0 for the default).
+ * @ctor:  Optional object constructor.
+ *
+ * Returns the new cache.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor)
+{
+    struct kmem_cache *cache = kmalloc0(sizeof(struct kmem_cache));
+    uint32_t n;
+
+    if (cache == NULL)
+        panic("kmalloc");
+
+    if (align < KMEM_MIN_ALIGN)
+        align = KMEM_MIN_ALIGN;
+    kassert("alignment is a power of two", (align & (align - 1)) == 0);
+
+    cache->c_name = name;
+    cache->c_align = align;
+    cache->c_size = ALIGN_UP(size, align);
+    cache->c_ctor = ctor;
+
+    // Fit as many objects as possible behind the descriptor and its free chain
+    n = (KMEM_SLAB_SIZE - sizeof(struct kmem_slab)) / (cache->c_size + sizeof(uint16_t));
+    while (n > 0 && ALIGN_UP(sizeof(struct kmem_slab) + n * sizeof(uint16_t), align) + n * cache->c_size > KMEM_SLAB_SIZE)
+        n--;
+    kassert("object fits in a slab", n > 0 && n < KMEM_FREE_END);
+
+    cache->c_per_slab = n;
+    cache->c_offset = ALIGN_UP(sizeof(struct kmem_slab) + n * sizeof(uint16_t), align);
+
+    return cache;
+}
+
+/**
+ * kmem_cache_alloc - Allocates one object from a cache.
+ *
+ * Partially used slabs are drained first, then the kept empty slab, and only
+ * then is a new page taken from the heap. Caches are updated with interrupts
+ * disabled, like the kernel heap.
+ *
+ * @cache: The cache to allocate from.
+ *
+ * Returns a pointer to the object.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache)
+{
+    uint32_t flags = irq_save();
+    struct kmem_slab *slab = cache->c_partial;
+    void *obj;
+
+    if (slab == NULL) {
+        slab = (cache->c_empty != NULL) ? cache->c_empty : slab_grow(cache);
+        slab_list_del(&cache->c_empty, slab);
+        slab_list_add(&cache->c_partial, slab);
+    }
+
+    // Pop the first free object
+    obj = slab_object(cache, slab, slab->s_free);
+    slab->s_free = slab->s_chain[slab->s_free];
+    slab->s_inuse++;
+
+    // Move the slab to the full list once its last object is gone
+    if (slab->s_free == KMEM_FREE_END) {
+        slab_list_del(&cache->c_partial, slab);
+        slab_list_add(&cache->c_full, slab);
+    }
+
+    cache->c_allocs++;
+    cache->c_inuse++;
+
+    irq_restore(flags);
+
+    return obj;
+}
+
+/**
+ * kmem_cache_free - Returns an object to its cache.
+ *
+ * A slab that becomes empty is kept for reuse, unless the cache already holds
+ * an empty slab, in which case its page is given back to the heap.
+ *
+ * @cache: The cache the object belongs to.
+ * @obj:   The object to free.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj)
+{
+    if (obj == NULL)
+        return;
+
+    // Slabs are page aligned, so the descriptor is at the start of the object's page
+    struct kmem_slab *slab = (struct kmem_slab *)((uint32_t)obj & ~(KMEM_SLAB_SIZE - 1));
+    uint32_t i = ((uint32_t)obj - (uint32_t)slab - cache->c_offset) / cache->c_size;
+    uint32_t flags = irq_save();
+
+    kassert("object belongs to this cache", slab->s_cache == cache);
+    kassert("object is in use", slab->s_inuse > 0);
+
+    // A full slab becomes partial again
+    if (slab->s_free == KMEM_FREE_END) {
+        slab_list_del(&cache->c_full, slab);
+        slab_list_add(&cache->c_partial, slab);
+    }
+
+    // Push the object onto the slab's free chain
+    slab->s_chain[i] = slab->s_free;
+    slab->s_free = i;
+    slab->s_inuse--;
+
+    cache->c_frees++;
+    cache->c_inuse--;
+
+    if (slab->s_inuse == 0) {
+        slab_list_del(&cache->c_partial, slab);
+        if (cache->c_empty == NULL) {
+            slab_list_add(&cache->c_empty, slab);
+        } else {
+            kfree(slab);
+            cache->c_slabs--;
+            cache->c_shrinks++;
+        }
+    }
+
+    irq_restore(flags);
+}
+
+/**
+ * kmem_cache_dump - Prints the statistics of a cache.
+ *
+ * @cache: The cache to report on.
+ */
+void kmem_cache_dump(struct kmem_cache *cache)
+{
+    printk("%s: size %u, %u/slab, %u in use, %u slabs\n", cache->c_name,
+           cache->c_size, cache->c_per_slab, cache->c_inuse, cache->c_slabs);
+    printk("  allocs %u, frees %u, grows %u, shrinks %u\n",
+           cache->c_allocs, cache->c_frees, cache->c_grows, cache->c_shrinks);
+}
@@ -0,0 +1,89 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include "system.h"
+
+/*
+ * Object caches (slab allocator) for fixed-size kernel objects.
+ * Each slab is one page-aligned page taken from the kernel heap. The slab
+ * descriptor sits at the start of the page, followed by a free-index chain
+ * and the objects themselves, so objects carry no per-object header.
+ */
+
+#define KMEM_SLAB_SIZE      0x1000      // Size of a slab (one page)
+#define KMEM_MIN_ALIGN      4           // Default object alignment
+#define KMEM_FREE_END       0xFFFF      // Terminates the free-index chain of a slab
+
+/*
+ * Object constructor. Called once for every object when its slab is created;
+ * objects must be returned to the cache in their constructed state.
+ */
+typedef void (*kmem_ctor_t)(void *obj);
+
+/* Descriptor at the start of every slab page */
+struct kmem_slab {
+    struct kmem_slab *s_next;       // Next slab on the same cache list
+    struct kmem_slab *s_prev;       // Previous slab on the same cache list
+    struct kmem_cache *s_cache;     // Cache that owns this slab
+    uint32_t s_inuse;               // Number of objects handed out from this slab
+    uint16_t s_free;                // Index of the first free object (KMEM_FREE_END if full)
+    uint16_t s_chain[];             // s_chain[i]: index of the free object after object i
+};
+
+/* A cache of equally sized objects */
+struct kmem_cache {
+    const char *c_name;             // Name reported by kmem_cache_dump()
+    size_t c_size;                  // Object size, rounded up to the alignment
+    size_t c_align;                 // Object alignment
+    uint32_t c_per_slab;            // Number of objects in each slab
+    uint32_t c_offset;              // Offset of the first object from the start of a slab
+    kmem_ctor_t c_ctor;             // Optional object constructor
+
+    struct kmem_slab *c_full;       // Slabs with no free objects
+    struct kmem_slab *c_partial;    // Slabs with some free objects
+    struct kmem_slab *c_empty;      // Slabs with no objects in use (at most one is kept)
+
+    /* Statistics */
+    uint32_t c_allocs;              // Total objects allocated
+    uint32_t c_frees;               // Total objects freed
+    uint32_t c_inuse;               // Objects currently in use
+    uint32_t c_slabs;               // Slabs currently owned by the cache
+    uint32_t c_grows;               // Slabs ever taken from the heap
+    uint32_t c_shrinks;             // Slabs ever given back to the heap
+};
+
+/**
+ * Creates a cache of objects of the given size.
+ *
+ * @param name  Name of the cache, used for statistics output.
+ * @param size  Size of each object, in bytes.
+ * @param align Required alignment of each object (power of two, 0 for the default).
+ * @param ctor  Optional constructor run on every object of a new slab (may be NULL).
+ * @return A pointer to the new cache.
+ */
+struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+
+/**
+ * Allocates one object from a cache.
+ *
+ * @param cache The cache to allocate from.
+ * @return A pointer to the object.
+ */
+void *kmem_cache_alloc(struct kmem_cache *cache);
+
+/**
+ * Returns an object to the cache it was allocated from.
+ *
+ * @param cache The cache the object belongs to.
+ * @param obj   The object to free.
+ */
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+/**
+ * Prints the statistics of a cache.
+ *
+ * @param cache The cache to report on.
+ */
+void kmem_cache_dump(struct kmem_cache *cache);
+
+#endif /* SLAB_H */
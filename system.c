@@ -45,9 +45,46 @@ uint16_t inw(uint16_t port)
     return ret;
 }
 
+/**
+ * irq_save
+ * Disables interrupts and returns the previous EFLAGS, so that a critical
+ * section can later restore the caller's interrupt state.
+ *
+ * @return The EFLAGS value before interrupts were disabled.
+ */
+uint32_t irq_save(void)
+{
+    uint32_t flags;
+    asm volatile ("pushf; pop %0; cli" : "=r" (flags) : : "memory");
+    return flags;
+}
+
+/**
+ * irq_restore
+ * Restores the interrupt state saved by irq_save().
+ *
+ * @param flags The EFLAGS value returned by irq_save().
+ */
+void irq_restore(uint32_t flags)
+{
+    asm volatile ("push %0; popf" : : "r" (flags) : "memory", "cc");
+}
+
+/**
+ * invlpg
+ * Drops the TLB entry of the page containing a virtual address.
+ *
+ * @param address The virtual address whose mapping changed.
+ */
+void invlpg(uint32_t address)
+{
+    asm volatile ("invlpg (%0)" : : "r" (address) : "memory");
+}
+
 /**
  * memset
  * Fills a block of memory with a specified value.
+ * The word-aligned middle of the block is filled a word at a time.
  *
  * @param b Pointer to the start of the memory block.
  * @param c Value to set (converted to unsigned char).
@@ -57,14 +94,83 @@ uint16_t inw(uint16_t port)
 void *memset(void *b, int c, size_t len)
 {
     char *bb = b;
+    uint32_t word = (uint8_t)c * 0x01010101;
+    size_t words;
 
-    while (len-- > 0) {
+    while (len > 0 && ((uint32_t)bb & 3) != 0) {
+        *bb++ = (char)c;
+        len--;
+    }
+
+    // Whole words with a single string instruction
+    words = len / 4;
+    asm volatile ("rep stosl" : "+D" (bb), "+c" (words) : "a" (word) : "memory");
+
+    for (len &= 3; len > 0; len--) {
         *bb++ = (char)c;
     }
 
     return b;
 }
 
+/**
+ * memmove
+ * Copies a block of memory, which may overlap the destination.
+ * Word-aligned blocks are copied a word at a time.
+ *
+ * @param dst Pointer to the destination.
+ * @param src Pointer to the source.
+ * @param len Number of bytes to copy.
+ * @return The destination pointer.
+ */
+void *memmove(void *dst, const void *src, size_t len)
+{
+    int words = (((uint32_t)dst | (uint32_t)src | len) & 3) == 0;
+
+    if ((uint32_t)dst <= (uint32_t)src) {
+        if (words) {
+            uint32_t *d = dst;
+            const uint32_t *s = src;
+            for (len /= 4; len > 0; len--)
+                *d++ = *s++;
+        } else {
+            char *d = dst;
+            const char *s = src;
+            while (len-- > 0)
+                *d++ = *s++;
+        }
+    } else {
+        // Copy backwards, so an overlapping source is read before it is overwritten
+        if (words) {
+            uint32_t *d = (uint32_t *)((uint32_t)dst + len);
+            const uint32_t *s = (const uint32_t *)((uint32_t)src + len);
+            for (len /= 4; len > 0; len--)
+                *--d = *--s;
+        } else {
+            char *d = (char *)dst + len;
+            const char *s = (const char *)src + len;
+            while (len-- > 0)
+                *--d = *--s;
+        }
+    }
+
+    return dst;
+}
+
+/**
+ * memcpy
+ * Copies a block of memory that does not overlap the destination.
+ *
+ * @param dst Pointer to the destination.
+ * @param src Pointer to the source.
+ * @param len Number of bytes to copy.
+ * @return The destination pointer.
+ */
+void *memcpy(void *dst, const void *src, size_t len)
+{
+    return memmove(dst, src, len);
+}
+
 /**
  * strlen
  * Calculates the length of a null-terminated string.
@@ -44,6 +44,32 @@ uint8_t inb(uint16_t port);
  */
 uint16_t inw(uint16_t port);
 
+/**
+ * irq_save
+ * Disables interrupts and returns the previous EFLAGS, so that a critical
+ * section can later restore the caller's interrupt state.
+ *
+ * @return The EFLAGS value before interrupts were disabled.
+ */
+uint32_t irq_save(void);
+
+/**
+ * irq_restore
+ * Restores the interrupt state saved by irq_save().
+ *
+ * @param flags The EFLAGS value returned by irq_save().
+ */
+void irq_restore(uint32_t flags);
+
+/**
+ * invlpg
+ * Drops the TLB entry of the page containing a virtual address. Must be
+ * called after a present mapping is changed or removed.
+ *
+ * @param address The virtual address whose mapping changed.
+ */
+void invlpg(uint32_t address);
+
 /**
  * _panic
  * Triggers a kernel panic, printing a formatted error message and halting the system.
@@ -64,6 +90,28 @@ void _panic(const char *fmt, ...);
  */
 void *memset(void *b, int c, size_t len);
 
+/**
+ * memmove
+ * Copies a block of memory; the source and destination may overlap.
+ *
+ * @param dst Pointer to the destination.
+ * @param src Pointer to the source.
+ * @param len Number of bytes to copy.
+ * @return The destination pointer.
+ */
+void *memmove(void *dst, const void *src, size_t len);
+
+/**
+ * memcpy
+ * Copies a block of memory; the source and destination must not overlap.
+ *
+ * @param dst Pointer to the destination.
+ * @param src Pointer to the source.
+ * @param len Number of bytes to copy.
+ * @return The destination pointer.
+ */
+void *memcpy(void *dst, const void *src, size_t len);
+
 /**
  * strlen
  * Calculates the length of a null-terminated string.
@@ -1,5 +1,5 @@
 #include "thread.h"
-#include "kmalloc.h"
+#include "slab.h"
 #include "scheduler.h"
 
 // Current running thread.
@@ -8,6 +8,9 @@ static thread_t *current_thread;
 // Global variable to assign unique thread IDs.
 uint32_t next_tid = 0;
 
+// Object cache for thread structures.
+static struct kmem_cache *thread_cache;
+
 // Forward declaration for thread exit function.
 void thread_exit();
 
@@ -23,9 +26,16 @@ extern void _create_thread(int (*fn)(void*), void *arg, uint32_t *stack, thread_
  * @return A pointer to the initialized thread structure.
  */
 thread_t *init_threading() {
+    // Create the cache that backs every thread structure.
+    thread_cache = kmem_cache_create("thread_t", sizeof(thread_t), 0, NULL);
+
     // Allocate memory for the initial thread structure.
-    thread_t *thread = kmalloc(sizeof(thread_t));
+    thread_t *thread = kmem_cache_alloc(thread_cache);
+    memset(thread, 0, sizeof(thread_t));  // Clear the memory for initialization.
     thread->id = next_tid++;  // Assign a unique thread ID.
+    thread->sched_class = &prio_sched_class;
+    thread->priority = thread->base_priority = SCHED_PRIO_DEFAULT;
+    thread->weight = SCHED_WEIGHT_DEFAULT;
 
     // Set the current thread to the newly created thread.
     current_thread = thread;
@@ -41,14 +51,17 @@ thread_t *init_threading() {
  * 
  * @param fn    The function the thread will execute.
  * @param arg   The argument passed to the thread function.
- * @param stack Pointer to the stack memory allocated for the thread.
+ * @param stack Pointer to the top of the stack (see kmalloc_stack()); every page of it must be backed.
  * @return A pointer to the newly created thread structure.
  */
 thread_t *create_thread(int (*fn)(void*), void *arg, uint32_t *stack) {
     // Allocate memory for the new thread structure.
-    thread_t *thread = kmalloc(sizeof(thread_t));
+    thread_t *thread = kmem_cache_alloc(thread_cache);
     memset(thread, 0, sizeof(thread_t));  // Clear the memory for initialization.
     thread->id = next_tid++;  // Assign a unique thread ID.
+    thread->sched_class = &prio_sched_class;
+    thread->priority = thread->base_priority = SCHED_PRIO_DEFAULT;
+    thread->weight = SCHED_WEIGHT_DEFAULT;
 
     // Set up the thread's stack in reverse order: arguments, return address, function pointer.
     *--stack = (uint32_t)arg;       // Argument for the thread function.
@@ -2,15 +2,25 @@
 #define THREAD_H
 
 #include "system.h"
+#include "timer.h"
+
+struct kmalloc_magazines;
+struct run_queue;
+struct sched_class;
+
+/* Thread states */
+#define THREAD_READY    0   /* Running, or waiting for the CPU */
+#define THREAD_BLOCKED  1   /* Waiting for thread_wake() or a timeout */
 
 /**
  * @struct thread_t
  * @brief Represents the context of a thread in the system.
  *
  * This structure holds the state of a thread, including its CPU registers 
- * and a unique identifier.
+ * and a unique identifier. switch_thread() depends on the offsets of the
+ * register fields, so new fields go at the end.
  */
-typedef struct {
+typedef struct thread {
     uint32_t esp;    ///< Stack pointer
     uint32_t ebp;    ///< Base pointer
     uint32_t ebx;    ///< General-purpose register
@@ -18,6 +28,31 @@ typedef struct {
     uint32_t edi;    ///< General-purpose register
     uint32_t eflags; ///< CPU flags register
     uint32_t id;     ///< Unique thread identifier
+    struct kmalloc_magazines *mags; ///< Per-thread kmalloc magazines (created on first use)
+    struct thread *rq_next;  ///< Next thread in its run queue
+    struct thread *rq_prev;  ///< Previous thread in its run queue
+    struct run_queue *rq;    ///< The run queue holding the thread, or NULL if it is not queued
+    uint32_t priority;       ///< Current scheduling priority (higher runs first)
+    uint32_t base_priority;  ///< Priority the thread starts at and is boosted back to
+    uint32_t slice;          ///< Timer ticks left in the current time slice
+    struct sched_class *sched_class; ///< Scheduling class the thread belongs to
+    uint32_t on_rq;          ///< Nonzero while the thread is queued in its class
+    uint32_t weight;         ///< CPU share of the thread in the fair class
+    uint64_t vruntime;       ///< Weighted virtual runtime in the fair class
+    uint32_t fair_heap;      ///< Random heap key of the thread's node in the fair class treap
+    struct thread *fair_left;  ///< Left child in the fair class treap
+    struct thread *fair_right; ///< Right child in the fair class treap
+    uint32_t dl_runtime;     ///< Deadline class: CPU ticks needed every period
+    uint32_t dl_deadline;    ///< Deadline class: ticks from the start of a period to its deadline
+    uint32_t dl_period;      ///< Deadline class: ticks between the starts of two periods
+    uint32_t dl_bw;          ///< Deadline class: runtime / deadline, in 1/SCHED_DL_BW_ONE units
+    uint32_t dl_release;     ///< Deadline class: start of the current (or next) period
+    uint32_t dl_abs_deadline; ///< Deadline class: deadline of the current period
+    uint32_t dl_budget;      ///< Deadline class: runtime left in the current period
+    uint32_t dl_misses;      ///< Deadline class: periods whose work was not done by the deadline
+    uint32_t dl_overruns;    ///< Deadline class: periods in which the runtime was used up
+    uint32_t state;          ///< THREAD_READY or THREAD_BLOCKED
+    struct timeout sleep;    ///< Wakes the thread up at the end of thread_sleep()
 } thread_t;
 
 /**
@@ -36,26 +71,18 @@ thread_t *init_threading();
  *
  * @param fn Pointer to the thread function to execute.
  * @param arg Argument to pass to the thread function.
- * @param stack Pointer to the pre-allocated stack memory.
+ * @param stack Pointer to the top of the pre-allocated stack, from kmalloc_stack().
  * @return A pointer to the newly created thread structure.
  */
 thread_t *create_thread(int (*fn)(void*), void *arg, uint32_t *stack);
 
-/**
- * @struct thread_list
- * @brief Represents a linked list or array of threads.
- *
- * This is likely defined elsewhere in the codebase.
- */
-struct thread_list;
-
 /**
  * @brief Switches execution to the next thread.
  *
  * Performs a context switch to the specified next thread.
  *
- * @param next Pointer to the next thread's list structure.
+ * @param next Pointer to the next thread.
  */
-void switch_thread(struct thread_list *next);
+void switch_thread(thread_t *next);
 
 #endif // THREAD_H
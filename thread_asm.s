@@ -5,7 +5,6 @@
         
 switch_thread:
         mov eax, [current_thread]
-        mov eax, [eax]
 
         mov [eax+0],  esp
         mov [eax+4],  ebp
@@ -20,7 +19,6 @@ switch_thread:
         mov eax, [esp+4]
 
         mov [current_thread], eax
-        mov eax, [eax]
         
         mov esp, [eax+0]
         mov ebp, [eax+4]
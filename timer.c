@@ -7,17 +7,110 @@
 // Static variable to keep track of ticks
 static uint32_t tick = 0;
 
+// Pending timeouts, hashed by the low bits of their expiry tick
+static struct timeout *timer_wheel[TIMER_WHEEL_SIZE];
+
+/**
+ * @brief Returns the number of timer ticks since the timer was started.
+ *
+ * @return The tick count.
+ */
+uint32_t timer_ticks(void) {
+    return tick;
+}
+
+/**
+ * @brief Unlinks a pending timeout from its slot.
+ *
+ * @param to The timeout.
+ */
+static void timeout_unlink(struct timeout *to) {
+    *to->to_pprev = to->to_next;
+    if (to->to_next)
+        to->to_next->to_pprev = to->to_pprev;
+    to->to_next = NULL;
+    to->to_pprev = NULL;
+}
+
+/**
+ * @brief Arms a timeout, replacing any pending expiry.
+ *
+ * @param to The timeout.
+ * @param ticks Number of ticks from now (at least 1).
+ * @param fn Function to call, with interrupts disabled, when the timeout fires.
+ * @param arg Argument for fn.
+ */
+void timeout_set(struct timeout *to, uint32_t ticks, void (*fn)(void *arg), void *arg) {
+    uint32_t flags = irq_save();
+    struct timeout **slot;
+
+    if (to->to_pprev)
+        timeout_unlink(to);
+
+    to->to_expires = tick + (ticks ? ticks : 1);
+    to->to_fn = fn;
+    to->to_arg = arg;
+
+    // Push at the head of the slot: O(1), whatever the number of timeouts
+    slot = &timer_wheel[to->to_expires & (TIMER_WHEEL_SIZE - 1)];
+    to->to_next = *slot;
+    if (to->to_next)
+        to->to_next->to_pprev = &to->to_next;
+    to->to_pprev = slot;
+    *slot = to;
+
+    irq_restore(flags);
+}
+
+/**
+ * @brief Disarms a timeout.
+ *
+ * @param to The timeout.
+ * @return Nonzero if the timeout was pending.
+ */
+int timeout_cancel(struct timeout *to) {
+    uint32_t flags = irq_save();
+    int pending = to->to_pprev != NULL;
+
+    if (pending)
+        timeout_unlink(to);
+
+    irq_restore(flags);
+    return pending;
+}
+
+/**
+ * @brief Fires the timeouts that expire on the current tick.
+ *
+ * Only the slot of the current tick is visited. Entries hashed there that
+ * expire on a later turn of the wheel are skipped.
+ */
+static void timer_wheel_advance(void) {
+    struct timeout *to = timer_wheel[tick & (TIMER_WHEEL_SIZE - 1)];
+    struct timeout *next;
+
+    for (; to; to = next) {
+        next = to->to_next;
+        if ((int32_t)(to->to_expires - tick) <= 0) {
+            timeout_unlink(to);
+            to->to_fn(to->to_arg);
+        }
+    }
+}
+
 /**
  * @brief Timer interrupt callback function.
  * 
  * This function is called whenever the timer interrupt occurs. It increments
- * the tick count and prints the current tick value to the screen.
+ * the tick count, fires the timeouts that are due and charges the tick to
+ * the running thread's time slice.
  * 
  * @param regs The CPU register state at the time of the interrupt (not used here).
  */
 static void timer_callback(registers_t *regs) {
 	tick++;
-  schedule ();
+  timer_wheel_advance ();
+  schedule_tick ();
 }
 
 /**
@@ -13,4 +13,45 @@
  */
 void init_timer(uint32_t freq);
 
+/*
+ * Timeouts. Pending timeouts are hashed by expiry tick into a wheel of
+ * TIMER_WHEEL_SIZE slots; every tick the timer interrupt runs the expired
+ * entries of one slot. A timeout is embedded in its owner, so setting one
+ * never allocates.
+ */
+#define TIMER_WHEEL_SIZE    64          /* Number of slots (a power of two) */
+
+struct timeout {
+    struct timeout *to_next;            /* Next timeout in the same slot */
+    struct timeout **to_pprev;          /* Link pointing at this timeout, or NULL if not pending */
+    uint32_t to_expires;                /* Tick at which the timeout fires */
+    void (*to_fn)(void *arg);           /* Called from the timer interrupt when it fires */
+    void *to_arg;                       /* Argument for to_fn */
+};
+
+/**
+ * @brief Returns the number of timer ticks since the timer was started.
+ *
+ * @return The tick count.
+ */
+uint32_t timer_ticks(void);
+
+/**
+ * @brief Arms a timeout, replacing any pending expiry.
+ *
+ * @param to The timeout.
+ * @param ticks Number of ticks from now (at least 1).
+ * @param fn Function to call, with interrupts disabled, when the timeout fires.
+ * @param arg Argument for fn.
+ */
+void timeout_set(struct timeout *to, uint32_t ticks, void (*fn)(void *arg), void *arg);
+
+/**
+ * @brief Disarms a timeout.
+ *
+ * @param to The timeout.
+ * @return Nonzero if the timeout was pending.
+ */
+int timeout_cancel(struct timeout *to);
+
 #endif /* TIMER_H */
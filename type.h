@@ -6,6 +6,8 @@
  * These typedefs ensure consistent type sizes across platforms.
  */
 
+typedef unsigned long long uint64_t; /* 64-bit unsigned integer */
+typedef long long       int64_t;  /* 64-bit signed integer */
 typedef unsigned int    uint32_t; /* 32-bit unsigned integer */
 typedef int             int32_t;  /* 32-bit signed integer */
 typedef unsigned short  uint16_t; /* 16-bit unsigned integer */